@@ -9,6 +9,7 @@ namespace asa { namespace api = windows; }
 namespace asa { namespace api = aix; }
 #else
 #include "platform/posix/host_info.hpp"
+#include "platform/posix/program.hpp"
 namespace asa { namespace api = posix; }
 #endif
 
@@ -40,6 +41,12 @@ public:
     }
 
     auto memory_usage(std::error_code& ec) {
+#if !_WIN32 && !_AIX
+        if (container_scope()) {
+            auto memory = api::get_container_memory(ec);
+            return ec ? int32_t{} : api::calculate_container_memory_usage(memory);
+        }
+#endif
         return api::get_memory_usage(ec);
     }
 
@@ -97,6 +104,155 @@ public:
     auto get_env(std::string_view name, std::error_code& ec) {
         return api::get_environment_variable(name, ec);
     }
+
+#if !_WIN32 && !_AIX //linux only
+private:
+    int8_t container_scope_ = -1; //-1 follows is_in_container
+
+public:
+    using container_memory = api::container_memory;
+    using container_cpu_occupy = api::container_cpu_occupy;
+    using cpu_core_occupy = api::cpu_core_occupy;
+    using cpu_core_usage = api::cpu_core_usage;
+    using memory_info = api::memory_info;
+    using pressure_resource = api::pressure_resource;
+    using pressure_kind = api::pressure_kind;
+    using pressure_info = api::pressure_info;
+    using pressure_trigger = api::pressure_trigger;
+    using pressure_monitor = api::pressure_monitor;
+    using card_counter = api::card_counter;
+    using card_rate = api::card_rate;
+    using card_rate_calculator = api::card_rate_calculator;
+    using network_topology = api::network_topology;
+    using network_topology_event = api::network_topology_event;
+    using route_entry = api::route_entry;
+    using route_index = api::route_index;
+    using port_bitmap = api::port_bitmap;
+    using tcp_state_mask = api::tcp_state_mask;
+    using port_allocator = api::port_allocator;
+    using socket_entry = api::socket_entry;
+    using socket_owner_map = api::socket_owner_map;
+    using tcp_connection_filter = api::tcp_connection_filter;
+    using tcp_connection_info = api::tcp_connection_info;
+    using tcp_subnet_health = api::tcp_subnet_health;
+    using tcp_health_collector = api::tcp_health_collector;
+    using log2_histogram = api::log2_histogram;
+    using collector = api::collector;
+    using host_snapshot = api::host_snapshot;
+
+public:
+    auto get_cpu_core_occupy(std::error_code& ec) {
+        return api::get_cpu_core_occupy(ec);
+    }
+
+    void get_cpu_core_occupy(cpu_core_occupy& occupy, std::error_code& ec) {
+        api::get_cpu_core_occupy(occupy, ec);
+    }
+
+    auto calculate_cpu_core_usage(const cpu_core_occupy& pre, const cpu_core_occupy& now) {
+        return api::calculate_cpu_core_usage(pre, now);
+    }
+
+    void calculate_cpu_core_usage(
+        const cpu_core_occupy& pre, const cpu_core_occupy& now, cpu_core_usage& usage)
+    {
+        api::calculate_cpu_core_usage(pre, now, usage);
+    }
+
+    auto get_memory_info(std::error_code& ec) {
+        return api::get_memory_info(ec);
+    }
+
+    auto calculate_memory_usage(const memory_info& info) {
+        return api::calculate_memory_usage(info);
+    }
+
+    auto get_pressure(pressure_resource resource, std::error_code& ec) {
+        return api::get_pressure_info(resource, ec);
+    }
+
+    //cgroup v2 <resource>.pressure file
+    auto get_pressure(const std::string& file, std::error_code& ec) {
+        return api::get_pressure_info(file, ec);
+    }
+
+    void get_network_card_counter(std::vector<card_counter>& counters, std::error_code& ec) {
+        api::get_network_card_counter(counters, ec);
+    }
+
+    //states is tcp_state_mask values combined with |, e.g. tcp_listen
+    void get_tcp_port_bitmap(port_bitmap& ports, uint32_t states, std::error_code& ec) {
+        api::get_tcp_port_bitmap(ports, states, ec);
+    }
+
+    //protocol is IPPROTO_TCP or IPPROTO_UDP, states is tcp_state_mask values combined with |
+    void get_socket_entry(std::vector<socket_entry>& entries, uint8_t protocol, uint32_t states, std::error_code& ec) {
+        api::get_socket_entry(entries, protocol, states, ec);
+    }
+
+    void get_tcp_connection_info(std::vector<tcp_connection_info>& infos,
+        const tcp_connection_filter& filter, std::error_code& ec)
+    {
+        api::get_tcp_connection_info(infos, filter, ec);
+    }
+
+    //family is AF_INET, AF_INET6 or AF_UNSPEC for both
+    void get_route_entry(std::vector<route_entry>& routes, uint8_t family, std::error_code& ec) {
+        api::get_route_entry(routes, family, ec);
+    }
+
+    //seconds may be fractional, e.g. from monotonic ns timestamps of two snapshots
+    void calculate_network_card_rate(const card_counter& pre, const card_counter& now, double seconds, card_rate& rate) {
+        api::calculate_card_rate(pre, now, seconds, rate);
+    }
+
+    //mask is collector values combined with |
+    auto snapshot(uint32_t mask, std::error_code& ec) {
+        return api::get_host_snapshot(mask, ec);
+    }
+
+    void snapshot(host_snapshot& snapshot, uint32_t mask, std::error_code& ec) {
+        api::get_host_snapshot(snapshot, mask, ec);
+    }
+
+    //in container scope memory_usage and cpu_count report the cgroup limits instead of the host.
+    //it is on by default when the process runs in a container.
+    void set_container_scope(bool enable) {
+        container_scope_ = enable ? 1 : 0;
+    }
+
+    bool container_scope() const {
+        if (container_scope_ == -1) {
+            static const bool in_container = api::is_in_container();
+            return in_container;
+        }
+        return container_scope_ == 1;
+    }
+
+    //cpus available for sizing thread pools, fractional when a cfs quota is set
+    double cpu_count(std::error_code& ec) {
+        if (container_scope()) {
+            return api::get_container_cpu_count(ec);
+        }
+        ec.clear();
+        return get_nprocs();
+    }
+
+    auto get_container_memory(std::error_code& ec) {
+        return api::get_container_memory(ec);
+    }
+
+    auto get_container_cpu_occupy(std::error_code& ec) {
+        return api::get_container_cpu_occupy(ec);
+    }
+
+    //percentage of cpu_count used by the container between two occupies
+    auto calculate_container_cpu_usage(
+        const container_cpu_occupy& pre, const container_cpu_occupy& now, double cpu_count)
+    {
+        return api::calculate_container_cpu_usage(pre, now, cpu_count);
+    }
+#endif
 };
 
 }
@@ -0,0 +1,60 @@
+#pragma once
+#include <chrono>
+#include <iterator>
+
+#include "sampler.hpp"
+#include "metrics_journal.hpp"
+
+namespace asa {
+
+//appends the fields of host_sample to a journal file, timestamped with the realtime clock
+//so records stay meaningful across restarts and reboots
+class host_sample_journal {
+private:
+    journal_writer writer_;
+
+public:
+    static std::vector<journal_column> columns() {
+        return {
+            { "cpu.usage", 100 },
+            { "cpu.iowait", 100 },
+            { "cpu.steal", 100 },
+            { "memory.usage", 100 },
+            { "memory.available_kb", 1 },
+            { "network.receive_bytes_per_second", 1 },
+            { "network.transmit_bytes_per_second", 1 },
+            { "pressure.cpu.some.avg10", 100 },
+            { "pressure.memory.some.avg10", 100 },
+            { "pressure.io.some.avg10", 100 }
+        };
+    }
+
+    //default keeps about a day of 1s samples in 4KB blocks
+    void open(const std::string& path, std::error_code& ec,
+        uint32_t block_size = 4096, uint32_t block_count = 8192)
+    {
+        writer_.open(path, columns(), block_size, block_count, ec);
+    }
+
+    void record(const host_sample& sample, std::error_code& ec) {
+        double values[] = {
+            sample.cpu_usage,
+            sample.cpu_iowait,
+            sample.cpu_steal,
+            sample.memory_usage,
+            (double)sample.memory.available,
+            sample.receive_bytes_per_second,
+            sample.transmit_bytes_per_second,
+            sample.cpu_pressure.some.avg10,
+            sample.memory_pressure.some.avg10,
+            sample.io_pressure.some.avg10
+        };
+        auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        writer_.append(static_cast<uint64_t>(now), values, std::size(values), ec);
+    }
+
+    journal_writer& writer() { return writer_; }
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "sampler.hpp"
+#include "metrics_history.hpp"
+
+namespace asa {
+
+//records the fields of host_sample into a metrics_history, e.g. from the sampler callback
+class host_sample_recorder {
+private:
+    metrics_history& history_;
+    size_t cpu_usage_;
+    size_t cpu_iowait_;
+    size_t cpu_steal_;
+    size_t memory_usage_;
+    size_t receive_;
+    size_t transmit_;
+    size_t cpu_pressure_;
+    size_t memory_pressure_;
+    size_t io_pressure_;
+
+public:
+    explicit host_sample_recorder(metrics_history& history)
+        : history_(history),
+        cpu_usage_(history.add_metric("cpu.usage")),
+        cpu_iowait_(history.add_metric("cpu.iowait")),
+        cpu_steal_(history.add_metric("cpu.steal")),
+        memory_usage_(history.add_metric("memory.usage")),
+        receive_(history.add_metric("network.receive_bytes_per_second")),
+        transmit_(history.add_metric("network.transmit_bytes_per_second")),
+        cpu_pressure_(history.add_metric("pressure.cpu.some.avg10")),
+        memory_pressure_(history.add_metric("pressure.memory.some.avg10")),
+        io_pressure_(history.add_metric("pressure.io.some.avg10")) {}
+
+    void record(const host_sample& sample) {
+        auto ts = sample.timestamp_ns;
+        if (sample.collected & host::collector::collect_cpu && sample.interval_ns != 0) {
+            history_.record(cpu_usage_, ts, sample.cpu_usage);
+            history_.record(cpu_iowait_, ts, sample.cpu_iowait);
+            history_.record(cpu_steal_, ts, sample.cpu_steal);
+        }
+        if (sample.collected & host::collector::collect_memory) {
+            history_.record(memory_usage_, ts, sample.memory_usage);
+        }
+        if (sample.collected & host::collector::collect_network && sample.interval_ns != 0) {
+            history_.record(receive_, ts, sample.receive_bytes_per_second);
+            history_.record(transmit_, ts, sample.transmit_bytes_per_second);
+        }
+        if (sample.collected & host::collector::collect_pressure) {
+            history_.record(cpu_pressure_, ts, sample.cpu_pressure.some.avg10);
+            history_.record(memory_pressure_, ts, sample.memory_pressure.some.avg10);
+            history_.record(io_pressure_, ts, sample.io_pressure.some.avg10);
+        }
+    }
+};
+
+}
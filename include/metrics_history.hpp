@@ -0,0 +1,317 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asa {
+
+struct metric_point {
+    uint64_t timestamp_ns;
+    double value;
+};
+
+struct metric_rollup {
+    uint64_t timestamp_ns; //start of the bucket
+    uint32_t count;
+    double min;
+    double max;
+    double avg;
+    double p99;
+};
+
+enum class resolution {
+    raw,         //every recorded value, e.g. 1s from the sampler
+    ten_seconds,
+    one_minute
+};
+
+//fixed-memory history of named metrics. every metric keeps a ring of raw values and rings of
+//10s/60s rollups, each stored column by column. all memory is allocated by add_metric,
+//record only writes into the rings. safe to record on one thread and query on others.
+class metrics_history {
+private:
+    static constexpr size_t rollup_count = 2;
+    static constexpr uint64_t bucket_ns[rollup_count] = { 10'000'000'000ull, 60'000'000'000ull };
+
+    struct raw_columns {
+        std::vector<uint64_t> timestamp;
+        std::vector<double> value;
+        size_t head = 0; //next slot to write
+        size_t size = 0;
+    };
+
+    struct rollup_columns {
+        std::vector<uint64_t> timestamp;
+        std::vector<uint32_t> count;
+        std::vector<double> min;
+        std::vector<double> max;
+        std::vector<double> avg;
+        std::vector<double> p99;
+        size_t head = 0;
+        size_t size = 0;
+    };
+
+    //the bucket being filled, values keeps at most bucket_capacity samples for p99
+    struct open_bucket {
+        uint64_t start = 0;
+        uint32_t count = 0;
+        double min = 0;
+        double max = 0;
+        double sum = 0;
+        std::vector<double> values;
+    };
+
+    struct metric {
+        std::string name;
+        raw_columns raw;
+        rollup_columns rollup[rollup_count];
+        open_bucket bucket[rollup_count];
+    };
+
+    size_t raw_capacity_;
+    size_t rollup_capacity_[rollup_count];
+    size_t bucket_capacity_;
+    std::vector<metric> metrics_;
+    std::unordered_map<std::string, size_t> index_;
+    mutable std::mutex mutex_;
+
+public:
+    //default keeps 1h of 1s values, 4h of 10s rollups and 24h of 60s rollups.
+    //bucket_capacity bounds the values kept per open bucket for p99.
+    explicit metrics_history(size_t raw_capacity = 3600, size_t ten_seconds_capacity = 1440,
+        size_t one_minute_capacity = 1440, size_t bucket_capacity = 600)
+        : raw_capacity_(std::max<size_t>(raw_capacity, 1)),
+        rollup_capacity_{ std::max<size_t>(ten_seconds_capacity, 1), std::max<size_t>(one_minute_capacity, 1) },
+        bucket_capacity_(std::max<size_t>(bucket_capacity, 1)) {}
+
+    metrics_history(const metrics_history&) = delete;
+    metrics_history& operator=(const metrics_history&) = delete;
+
+    //return the id of the metric, register it on first use
+    size_t add_metric(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (auto it = index_.find(name); it != index_.end()) {
+            return it->second;
+        }
+
+        metric m;
+        m.name = name;
+        m.raw.timestamp.resize(raw_capacity_);
+        m.raw.value.resize(raw_capacity_);
+        for (size_t i = 0; i < rollup_count; i++) {
+            auto& r = m.rollup[i];
+            for (auto column : { &r.min, &r.max, &r.avg, &r.p99 }) {
+                column->resize(rollup_capacity_[i]);
+            }
+            r.timestamp.resize(rollup_capacity_[i]);
+            r.count.resize(rollup_capacity_[i]);
+            m.bucket[i].values.reserve(bucket_capacity_);
+        }
+        metrics_.emplace_back(std::move(m));
+        index_.emplace(name, metrics_.size() - 1);
+        return metrics_.size() - 1;
+    }
+
+    bool find_metric(const std::string& name, size_t& id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(name);
+        if (it == index_.end()) {
+            return false;
+        }
+        id = it->second;
+        return true;
+    }
+
+    std::vector<std::string> metric_names() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::string> names;
+        names.reserve(metrics_.size());
+        for (const auto& m : metrics_) {
+            names.emplace_back(m.name);
+        }
+        return names;
+    }
+
+    //steady_clock, CLOCK_MONOTONIC on linux like the timestamps of host_sample.
+    //the default end of query and summarize, record with another clock passes end explicitly.
+    static uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    //timestamps of one metric are expected to be increasing, older values are dropped
+    void record(size_t id, uint64_t timestamp_ns, double value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= metrics_.size()) {
+            return;
+        }
+        auto& m = metrics_[id];
+        auto& raw = m.raw;
+        if (raw.size != 0 && timestamp_ns < raw.timestamp[prev(raw.head, raw_capacity_)]) {
+            return;
+        }
+        raw.timestamp[raw.head] = timestamp_ns;
+        raw.value[raw.head] = value;
+        raw.head = (raw.head + 1) % raw_capacity_;
+        raw.size = std::min(raw.size + 1, raw_capacity_);
+
+        for (size_t i = 0; i < rollup_count; i++) {
+            auto& bucket = m.bucket[i];
+            auto start = timestamp_ns - timestamp_ns % bucket_ns[i];
+            if (bucket.count != 0 && start != bucket.start) {
+                close_bucket(m.rollup[i], bucket, rollup_capacity_[i]);
+            }
+            if (bucket.count == 0) {
+                bucket.start = start;
+                bucket.min = value;
+                bucket.max = value;
+                bucket.sum = 0;
+                bucket.values.clear();
+            }
+            bucket.count++;
+            bucket.min = std::min(bucket.min, value);
+            bucket.max = std::max(bucket.max, value);
+            bucket.sum += value;
+            if (bucket.values.size() < bucket_capacity_) {
+                bucket.values.push_back(value);
+            }
+        }
+    }
+
+    //raw values within window before end, oldest first. a metric no longer recorded has nothing
+    //in a window that ends now, instead of its last values.
+    size_t query(size_t id, std::chrono::nanoseconds window, std::vector<metric_point>& out,
+        uint64_t end_ns = now_ns()) const
+    {
+        out.clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= metrics_.size()) {
+            return 0;
+        }
+        auto& raw = metrics_[id].raw;
+        if (raw.size == 0) {
+            return 0;
+        }
+        auto from = window_start(end_ns, window);
+        auto first = (raw.head + raw_capacity_ - raw.size) % raw_capacity_;
+        for (size_t n = 0; n < raw.size; n++) {
+            auto i = (first + n) % raw_capacity_;
+            if (raw.timestamp[i] >= from && raw.timestamp[i] <= end_ns) {
+                out.push_back({ raw.timestamp[i], raw.value[i] });
+            }
+        }
+        return out.size();
+    }
+
+    //closed rollups starting within window before end, oldest first.
+    //resolution::raw returns each raw value as a rollup of one.
+    size_t query(size_t id, resolution res, std::chrono::nanoseconds window,
+        std::vector<metric_rollup>& out, uint64_t end_ns = now_ns()) const
+    {
+        out.clear();
+        if (res == resolution::raw) {
+            std::vector<metric_point> points;
+            query(id, window, points, end_ns);
+            for (const auto& p : points) {
+                out.push_back({ p.timestamp_ns, 1, p.value, p.value, p.value, p.value });
+            }
+            return out.size();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= metrics_.size()) {
+            return 0;
+        }
+        auto level = static_cast<size_t>(res) - 1;
+        auto& r = metrics_[id].rollup[level];
+        auto capacity = rollup_capacity_[level];
+        if (r.size == 0) {
+            return 0;
+        }
+        auto from = window_start(end_ns, window);
+        auto first = (r.head + capacity - r.size) % capacity;
+        for (size_t n = 0; n < r.size; n++) {
+            auto i = (first + n) % capacity;
+            if (r.timestamp[i] >= from && r.timestamp[i] <= end_ns) {
+                out.push_back({ r.timestamp[i], r.count[i], r.min[i], r.max[i], r.avg[i], r.p99[i] });
+            }
+        }
+        return out.size();
+    }
+
+    //one rollup over the whole window. p99 is exact for raw, for coarser resolutions it is
+    //the largest bucket p99, an upper bound.
+    metric_rollup summarize(size_t id, resolution res, std::chrono::nanoseconds window,
+        uint64_t end_ns = now_ns()) const
+    {
+        metric_rollup summary{};
+        std::vector<metric_rollup> rollups;
+        if (query(id, res, window, rollups, end_ns) == 0) {
+            return summary;
+        }
+
+        summary.timestamp_ns = rollups.front().timestamp_ns;
+        summary.min = std::numeric_limits<double>::max();
+        summary.max = std::numeric_limits<double>::lowest();
+        summary.p99 = std::numeric_limits<double>::lowest();
+        double sum = 0;
+        for (const auto& r : rollups) {
+            summary.count += r.count;
+            summary.min = std::min(summary.min, r.min);
+            summary.max = std::max(summary.max, r.max);
+            summary.p99 = std::max(summary.p99, r.p99);
+            sum += r.avg * r.count;
+        }
+        summary.avg = sum / summary.count;
+        if (res == resolution::raw) {
+            std::vector<double> values;
+            values.reserve(rollups.size());
+            for (const auto& r : rollups) {
+                values.push_back(r.avg);
+            }
+            summary.p99 = percentile(values, 0.99);
+        }
+        return summary;
+    }
+
+private:
+    static size_t prev(size_t head, size_t capacity) {
+        return (head + capacity - 1) % capacity;
+    }
+
+    static uint64_t window_start(uint64_t end, std::chrono::nanoseconds window) {
+        auto span = static_cast<uint64_t>(std::max<int64_t>(window.count(), 0));
+        return end > span ? end - span + 1 : 0;
+    }
+
+    //nearest rank, reorders values
+    static double percentile(std::vector<double>& values, double p) {
+        if (values.empty()) {
+            return 0;
+        }
+        auto rank = static_cast<size_t>(std::ceil(p * (double)values.size()));
+        rank = std::clamp<size_t>(rank, 1, values.size()) - 1;
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+    static void close_bucket(rollup_columns& r, open_bucket& bucket, size_t capacity) {
+        r.timestamp[r.head] = bucket.start;
+        r.count[r.head] = bucket.count;
+        r.min[r.head] = bucket.min;
+        r.max[r.head] = bucket.max;
+        r.avg[r.head] = bucket.sum / bucket.count;
+        r.p99[r.head] = percentile(bucket.values, 0.99);
+        r.head = (r.head + 1) % capacity;
+        r.size = std::min(r.size + 1, capacity);
+        bucket.count = 0;
+    }
+};
+
+}
@@ -0,0 +1,425 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if _WIN32 || _AIX
+#error "metrics_journal is linux only"
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace asa {
+
+//file layout: one 4KB journal_header followed by block_count blocks of block_size bytes used as a ring.
+//every block starts with journal_block and holds whole records. the first record of a block stores
+//absolute values, the following ones store deltas against the previous record, all as zigzag varints,
+//so each block decodes on its own and a reader can start at any surviving block.
+//record: timestamp_ns, then one value per column stored as llround(value * scale).
+
+constexpr char journal_magic[8] = { 'A', 'S', 'A', 'J', 'R', 'N', 'L', '\0' };
+constexpr uint32_t journal_version = 1;
+constexpr size_t journal_max_columns = 64;
+
+struct journal_column {
+    std::string name; //at most 47 characters
+    double scale;     //values are kept as integers of value * scale, e.g. 100 for two decimals
+};
+
+struct journal_column_entry {
+    char name[48];
+    double scale;
+};
+
+struct journal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t column_count;
+    uint32_t block_size;
+    uint32_t block_count;
+    std::atomic<uint64_t> head_sequence; //sequence of the block being written, block index is sequence % block_count
+    journal_column_entry columns[journal_max_columns];
+};
+
+struct journal_block {
+    std::atomic<uint64_t> sequence; //changed before the block is reused
+    std::atomic<uint32_t> used;     //bytes of records, published after they are written
+    uint32_t count;
+};
+
+constexpr size_t journal_header_size = 4096;
+static_assert(sizeof(journal_header) <= journal_header_size, "journal header too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "journal needs lock free atomics in shared memory");
+
+inline uint64_t journal_zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t journal_unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+inline size_t journal_put_varint(uint8_t* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+inline bool journal_get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        auto byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class journal_mapping {
+protected:
+    int fd_ = -1;
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+
+    journal_mapping() = default;
+    ~journal_mapping() { close(); }
+
+    journal_header* header() const { return reinterpret_cast<journal_header*>(base_); }
+
+    journal_block* block(uint64_t sequence) const {
+        auto h = header();
+        return reinterpret_cast<journal_block*>(
+            base_ + journal_header_size + (sequence % h->block_count) * h->block_size);
+    }
+
+    uint8_t* block_data(journal_block* b) const {
+        return reinterpret_cast<uint8_t*>(b) + sizeof(journal_block);
+    }
+
+    void map(int prot, std::error_code& ec) {
+        struct stat st {};
+        if (fstat(fd_, &st) == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ < journal_header_size) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return;
+        }
+        auto addr = mmap(nullptr, size_, prot, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            ec = std::error_code(errno, std::system_category());
+            return;
+        }
+        base_ = static_cast<uint8_t*>(addr);
+
+        auto h = header();
+        if (memcmp(h->magic, journal_magic, sizeof(journal_magic)) != 0 ||
+            h->version != journal_version || h->column_count > journal_max_columns ||
+            h->block_size <= sizeof(journal_block) || h->block_size % alignof(journal_block) != 0 ||
+            h->block_count == 0 ||
+            size_ < journal_header_size + (size_t)h->block_size * h->block_count) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+        }
+    }
+
+public:
+    journal_mapping(const journal_mapping&) = delete;
+    journal_mapping& operator=(const journal_mapping&) = delete;
+
+    bool is_open() const { return base_ != nullptr; }
+
+    std::vector<journal_column> columns() const {
+        std::vector<journal_column> cols;
+        if (!is_open()) {
+            return cols;
+        }
+        for (uint32_t i = 0; i < header()->column_count; i++) {
+            auto& entry = header()->columns[i];
+            cols.push_back({ std::string(entry.name, strnlen(entry.name, sizeof(entry.name))), entry.scale });
+        }
+        return cols;
+    }
+
+    void close() {
+        if (base_ != nullptr) {
+            munmap(base_, size_);
+            base_ = nullptr;
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        size_ = 0;
+    }
+};
+
+//single writer of a journal file, guarded by flock. appending is a memcpy into the mapping.
+class journal_writer : public journal_mapping {
+private:
+    std::vector<int64_t> last_;
+    std::vector<uint8_t> record_;
+    int64_t last_timestamp_ = 0;
+    journal_block* current_ = nullptr;
+
+public:
+    journal_writer() = default;
+
+    //create the file or reopen it when columns and geometry match, writing resumes in a new block
+    void open(const std::string& path, const std::vector<journal_column>& columns,
+        uint32_t block_size, uint32_t block_count, std::error_code& ec)
+    {
+        ec.clear();
+        close();
+        if (columns.empty() || columns.size() > journal_max_columns || block_count == 0 ||
+            block_size % alignof(journal_block) != 0 ||
+            block_size < sizeof(journal_block) + 10 * (columns.size() + 1)) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return;
+        }
+
+        fd_ = ::open(path.data(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return;
+        }
+        if (flock(fd_, LOCK_EX | LOCK_NB) == -1) {
+            ec = std::error_code(errno, std::system_category());
+            close();
+            return;
+        }
+
+        struct stat st {};
+        if (fstat(fd_, &st) == -1) {
+            ec = std::error_code(errno, std::system_category());
+            close();
+            return;
+        }
+        bool create = (st.st_size == 0);
+        if (create) {
+            auto size = journal_header_size + (size_t)block_size * block_count;
+            if (ftruncate(fd_, static_cast<off_t>(size)) == -1) {
+                ec = std::error_code(errno, std::system_category());
+                close();
+                return;
+            }
+            journal_header h{};
+            memcpy(h.magic, journal_magic, sizeof(journal_magic));
+            h.version = journal_version;
+            h.column_count = static_cast<uint32_t>(columns.size());
+            h.block_size = block_size;
+            h.block_count = block_count;
+            for (size_t i = 0; i < columns.size(); i++) {
+                strncpy(h.columns[i].name, columns[i].name.data(), sizeof(h.columns[i].name) - 1);
+                h.columns[i].scale = columns[i].scale;
+            }
+            if (pwrite(fd_, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+                ec = std::error_code(errno, std::system_category());
+                close();
+                return;
+            }
+        }
+
+        map(PROT_READ | PROT_WRITE, ec);
+        if (!ec && (header()->block_size != block_size || header()->block_count != block_count ||
+            !same_columns(columns))) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+        }
+        if (ec) {
+            close();
+            return;
+        }
+
+        last_.assign(columns.size(), 0);
+        record_.resize(10 * (columns.size() + 1));
+        auto sequence = header()->head_sequence.load(std::memory_order_acquire);
+        start_block(create ? sequence : sequence + 1);
+    }
+
+    void append(uint64_t timestamp_ns, const double* values, size_t count, std::error_code& ec) {
+        ec.clear();
+        if (!is_open() || count != last_.size()) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return;
+        }
+
+        auto keyframe = (current_->count == 0);
+        auto len = encode(timestamp_ns, values, keyframe);
+        auto used = current_->used.load(std::memory_order_relaxed);
+        if (sizeof(journal_block) + used + len > header()->block_size) {
+            start_block(header()->head_sequence.load(std::memory_order_relaxed) + 1);
+            used = 0;
+            len = encode(timestamp_ns, values, true);
+        }
+        memcpy(block_data(current_) + used, record_.data(), len);
+        current_->count++;
+        current_->used.store(used + static_cast<uint32_t>(len), std::memory_order_release);
+    }
+
+    void append(uint64_t timestamp_ns, const std::vector<double>& values, std::error_code& ec) {
+        append(timestamp_ns, values.data(), values.size(), ec);
+    }
+
+    //write dirty pages to disk, not needed for readers on the same host
+    void flush(std::error_code& ec) {
+        ec.clear();
+        if (is_open() && msync(base_, size_, MS_ASYNC) == -1) {
+            ec = std::error_code(errno, std::system_category());
+        }
+    }
+
+private:
+    bool same_columns(const std::vector<journal_column>& columns) const {
+        auto h = header();
+        if (h->column_count != columns.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (strncmp(h->columns[i].name, columns[i].name.data(), sizeof(h->columns[i].name) - 1) != 0 ||
+                h->columns[i].scale != columns[i].scale) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void start_block(uint64_t sequence) {
+        current_ = block(sequence);
+        //readers still copying the old content see the sequence change and drop it,
+        //readers seeing the new sequence also see used reset
+        current_->sequence.store(UINT64_MAX, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        current_->used.store(0, std::memory_order_relaxed);
+        current_->count = 0;
+        current_->sequence.store(sequence, std::memory_order_release);
+        header()->head_sequence.store(sequence, std::memory_order_release);
+    }
+
+    size_t encode(uint64_t timestamp_ns, const double* values, bool keyframe) {
+        auto out = record_.data();
+        size_t n = 0;
+        auto ts = static_cast<int64_t>(timestamp_ns);
+        n += journal_put_varint(out + n, journal_zigzag(keyframe ? ts : ts - last_timestamp_));
+        for (size_t i = 0; i < last_.size(); i++) {
+            auto scaled = values[i] * header()->columns[i].scale;
+            auto v = std::isfinite(scaled) ? static_cast<int64_t>(std::llround(scaled)) : 0;
+            n += journal_put_varint(out + n, journal_zigzag(keyframe ? v : v - last_[i]));
+            last_[i] = v;
+        }
+        last_timestamp_ = ts;
+        return n;
+    }
+};
+
+//reads a journal file mapped read only, concurrently with the writer
+class journal_reader : public journal_mapping {
+private:
+    std::vector<uint8_t> copy_;
+    std::vector<int64_t> last_;
+    std::vector<double> values_;
+
+public:
+    journal_reader() = default;
+
+    void open(const std::string& path, std::error_code& ec) {
+        ec.clear();
+        close();
+        fd_ = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+        if (fd_ == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return;
+        }
+        map(PROT_READ, ec);
+        if (ec) {
+            close();
+            return;
+        }
+        copy_.resize(header()->block_size);
+        last_.resize(header()->column_count);
+        values_.resize(header()->column_count);
+    }
+
+    //call f(timestamp_ns, const double* values, size_t count) for every record at or after
+    //from_ns, oldest first. return the number of records visited.
+    template<typename F>
+    size_t read(uint64_t from_ns, F&& f, std::error_code& ec) {
+        ec.clear();
+        if (!is_open()) {
+            ec = std::make_error_code(std::errc::bad_file_descriptor);
+            return 0;
+        }
+        auto h = header();
+        auto head = h->head_sequence.load(std::memory_order_acquire);
+        auto oldest = head >= h->block_count ? head - h->block_count + 1 : 0;
+        size_t visited = 0;
+        for (auto sequence = oldest; sequence <= head; sequence++) {
+            size_t len = 0;
+            if (!copy_block(sequence, len)) {
+                continue; //overwritten while reading
+            }
+            visited += decode(copy_.data(), copy_.data() + len, from_ns, f);
+        }
+        return visited;
+    }
+
+private:
+    bool copy_block(uint64_t sequence, size_t& len) {
+        auto b = block(sequence);
+        if (b->sequence.load(std::memory_order_acquire) != sequence) {
+            return false;
+        }
+        len = b->used.load(std::memory_order_acquire);
+        len = std::min(len, copy_.size() - sizeof(journal_block));
+        memcpy(copy_.data(), block_data(b), len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return b->sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    template<typename F>
+    size_t decode(const uint8_t* p, const uint8_t* end, uint64_t from_ns, F& f) {
+        auto h = header();
+        size_t visited = 0;
+        int64_t ts = 0;
+        bool keyframe = true;
+        while (p < end) {
+            uint64_t v = 0;
+            if (!journal_get_varint(p, end, v)) {
+                break;
+            }
+            ts = keyframe ? journal_unzigzag(v) : ts + journal_unzigzag(v);
+            bool ok = true;
+            for (uint32_t i = 0; i < h->column_count && ok; i++) {
+                ok = journal_get_varint(p, end, v);
+                last_[i] = keyframe ? journal_unzigzag(v) : last_[i] + journal_unzigzag(v);
+                values_[i] = h->columns[i].scale != 0 ? (double)last_[i] / h->columns[i].scale : 0;
+            }
+            if (!ok) {
+                break;
+            }
+            keyframe = false;
+            if (static_cast<uint64_t>(ts) >= from_ns) {
+                f(static_cast<uint64_t>(ts), static_cast<const double*>(values_.data()), values_.size());
+                visited++;
+            }
+        }
+        return visited;
+    }
+};
+
+}
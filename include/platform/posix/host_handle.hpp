@@ -1,26 +1,144 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <cstring>
 #include <unordered_map>
 #include <unordered_set>
 #include <stdio.h>
 #include <memory>
+#include <algorithm>
+#include <math.h>
 
 namespace asa {
 namespace posix {
 
+//jiffies of a cpu line in /proc/stat
 struct cpu_occupy {
-	char name[256];
     uint64_t user;
     uint64_t nice;
     uint64_t system;
     uint64_t idle;
+    uint64_t iowait;
+    uint64_t irq;
+    uint64_t softirq;
+    uint64_t steal;
+    uint64_t guest;      //already counted in user
+    uint64_t guest_nice; //already counted in nice
 };
 
+//every cpuN line of /proc/stat as structure of arrays, column i belongs to cpu core[i]
+struct cpu_core_occupy {
+    cpu_occupy total; //the aggregate cpu line
+    std::vector<uint32_t> core;
+    std::vector<uint64_t> user;
+    std::vector<uint64_t> nice;
+    std::vector<uint64_t> system;
+    std::vector<uint64_t> idle;
+    std::vector<uint64_t> iowait;
+    std::vector<uint64_t> irq;
+    std::vector<uint64_t> softirq;
+    std::vector<uint64_t> steal;
+    std::vector<uint64_t> guest;
+    std::vector<uint64_t> guest_nice;
+
+    size_t size() const { return core.size(); }
+
+    //keep the capacity, so refilling a snapshot does not allocate
+    void clear() {
+        total = {};
+        core.clear();
+        for (auto column : { &user, &nice, &system, &idle, &iowait,
+            &irq, &softirq, &steal, &guest, &guest_nice }) {
+            column->clear();
+        }
+    }
+};
+
+//percentage of the interval spent in each state per core, usage is everything but idle and iowait
+struct cpu_core_usage {
+    std::vector<uint32_t> core;
+    std::vector<double> user;
+    std::vector<double> nice;
+    std::vector<double> system;
+    std::vector<double> idle;
+    std::vector<double> iowait;
+    std::vector<double> irq;
+    std::vector<double> softirq;
+    std::vector<double> steal;
+    std::vector<double> usage;
+
+    size_t size() const { return core.size(); }
+};
+
+//every field of /proc/meminfo in kB, huge_pages_total/free/rsvd/surp are page counts.
+//fields the running kernel does not report stay 0.
 struct memory_info {
-	uint64_t total;
-	uint64_t free;
+    uint64_t total;
+    uint64_t free;
+    uint64_t available;
     uint64_t buffers;
     uint64_t cached;
+    uint64_t swap_cached;
+    uint64_t active;
+    uint64_t inactive;
+    uint64_t active_anon;
+    uint64_t inactive_anon;
+    uint64_t active_file;
+    uint64_t inactive_file;
+    uint64_t unevictable;
+    uint64_t mlocked;
+    uint64_t high_total;
+    uint64_t high_free;
+    uint64_t low_total;
+    uint64_t low_free;
+    uint64_t mmap_copy;
+    uint64_t swap_total;
+    uint64_t swap_free;
+    uint64_t zswap;
+    uint64_t zswapped;
+    uint64_t dirty;
+    uint64_t writeback;
+    uint64_t anon_pages;
+    uint64_t mapped;
+    uint64_t shmem;
+    uint64_t kreclaimable;
+    uint64_t slab;
+    uint64_t sreclaimable;
+    uint64_t sunreclaim;
+    uint64_t kernel_stack;
+    uint64_t shadow_call_stack;
+    uint64_t page_tables;
+    uint64_t sec_page_tables;
+    uint64_t quicklists;
+    uint64_t nfs_unstable;
+    uint64_t bounce;
+    uint64_t writeback_tmp;
+    uint64_t commit_limit;
+    uint64_t committed_as;
+    uint64_t vmalloc_total;
+    uint64_t vmalloc_used;
+    uint64_t vmalloc_chunk;
+    uint64_t percpu;
+    uint64_t hardware_corrupted;
+    uint64_t anon_huge_pages;
+    uint64_t shmem_huge_pages;
+    uint64_t shmem_pmd_mapped;
+    uint64_t file_huge_pages;
+    uint64_t file_pmd_mapped;
+    uint64_t cma_total;
+    uint64_t cma_free;
+    uint64_t unaccepted;
+    uint64_t balloon;
+    uint64_t huge_pages_total;
+    uint64_t huge_pages_free;
+    uint64_t huge_pages_rsvd;
+    uint64_t huge_pages_surp;
+    uint64_t huge_page_size;
+    uint64_t hugetlb;
+    uint64_t direct_map_4k;
+    uint64_t direct_map_2m;
+    uint64_t direct_map_4m;
+    uint64_t direct_map_1g;
 };
 
 struct networkcard {
@@ -44,14 +162,254 @@ enum class card_state {
 	down
 };
 
+//one route of an RTM_GETROUTE dump. addresses are in network byte order, an ipv4 address uses the
+//first 4 bytes. a multipath route gives one entry per next hop.
+struct route_entry {
+	uint8_t family;        //AF_INET or AF_INET6
+	uint8_t prefix_length;
+	uint8_t type;          //RTN_UNICAST, RTN_LOCAL, RTN_BLACKHOLE ...
+	uint8_t protocol;      //RTPROT_KERNEL, RTPROT_BOOT, RTPROT_STATIC ...
+	uint8_t scope;
+	bool has_gateway;
+	uint32_t table;        //RT_TABLE_MAIN, RT_TABLE_LOCAL ...
+	uint32_t ifindex;      //0 for routes without a device, e.g. unreachable
+	uint32_t metric;
+	uint8_t destination[16];
+	uint8_t gateway[16];
+	uint8_t source[16];    //preferred source address, zero when not set
+};
+
+//one bit per port, 8KB for every port
+struct port_bitmap {
+	uint64_t words[65536 / 64];
+
+	bool test(uint16_t port) const {
+		return (words[port >> 6] >> (port & 63)) & 1u;
+	}
+
+	void set(uint16_t port) {
+		words[port >> 6] |= 1ull << (port & 63);
+	}
+
+	void reset(uint16_t port) {
+		words[port >> 6] &= ~(1ull << (port & 63));
+	}
+
+	void clear() {
+		memset(words, 0, sizeof(words));
+	}
+
+	size_t count() const {
+		size_t n = 0;
+		for (auto word : words) {
+			n += static_cast<size_t>(__builtin_popcountll(word));
+		}
+		return n;
+	}
+};
+
+//log2 histogram, bucket i counts values in [2^(i-1), 2^i), bucket 0 counts 0
+struct log2_histogram {
+	static constexpr size_t bucket_count = 64;
+	uint64_t buckets[bucket_count];
+	uint64_t count;
+	uint64_t max;
+
+	void add(uint64_t value) {
+		size_t i = 0;
+		while (i + 1 < bucket_count && (value >> i) != 0) {
+			i++;
+		}
+		buckets[i]++;
+		count++;
+		max = std::max(max, value);
+	}
+
+	//upper bound of the bucket holding the p quantile, p in (0, 1]
+	uint64_t percentile(double p) const {
+		if (count == 0) {
+			return 0;
+		}
+		auto rank = static_cast<uint64_t>(ceil(p * (double)count));
+		rank = std::clamp<uint64_t>(rank, 1, count);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; i++) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				return i == 0 ? 0 : std::min<uint64_t>(max, (1ull << i) - 1);
+			}
+		}
+		return max;
+	}
+};
+
+//masks of tcp states for socket enumeration, a bit per state of linux/tcp_states.h
+enum tcp_state_mask : uint32_t {
+	tcp_established = 1 << 1,
+	tcp_syn_sent = 1 << 2,
+	tcp_syn_recv = 1 << 3,
+	tcp_fin_wait1 = 1 << 4,
+	tcp_fin_wait2 = 1 << 5,
+	tcp_time_wait = 1 << 6,
+	tcp_close = 1 << 7,
+	tcp_close_wait = 1 << 8,
+	tcp_last_ack = 1 << 9,
+	tcp_listen = 1 << 10,
+	tcp_closing = 1 << 11,
+	tcp_all_states = 0xffe
+};
+
+//one socket from sock_diag, ports are in host order
+struct socket_entry {
+	uint8_t family;   //AF_INET or AF_INET6
+	uint8_t protocol; //IPPROTO_TCP or IPPROTO_UDP
+	uint8_t state;    //TCP_ESTABLISHED... of linux/tcp_states.h
+	uint16_t local_port;
+	uint16_t remote_port;
+	uint32_t uid;
+	uint64_t inode;   //0 for sockets without a file, e.g. time wait
+	uint8_t local_address[16];  //4 bytes used for AF_INET
+	uint8_t remote_address[16];
+};
+
+//selects the connections of get_tcp_connection_info, evaluated by the kernel. zero fields match any
+struct tcp_connection_filter {
+	uint32_t states = tcp_established; //tcp_state_mask values combined with |
+	uint16_t local_port = 0;
+	uint16_t remote_port = 0;
+	uint8_t remote_family = 0;        //AF_INET or AF_INET6 to match remote_address
+	uint8_t remote_prefix_length = 0;
+	uint8_t remote_address[16] = {};  //ipv4 also matches ipv4 mapped ipv6 peers
+};
+
+//tcp_info of one connection from INET_DIAG_INFO
+struct tcp_connection_info {
+	socket_entry socket;
+	uint32_t rtt;           //smoothed, us
+	uint32_t rtt_var;       //us
+	uint32_t snd_cwnd;      //segments
+	uint32_t unacked;       //segments in flight
+	uint32_t retrans;       //segments being retransmitted
+	uint32_t total_retrans; //segments retransmitted over the connection lifetime
+	uint64_t delivery_rate; //bytes per second, 0 before linux 4.9
+};
+
+//connections to one remote subnet, ipv4 mapped peers count as ipv4
+struct tcp_subnet_health {
+	uint8_t family;
+	uint8_t prefix_length;
+	uint8_t address[16];    //masked to prefix_length
+	uint32_t connections;
+	uint64_t retrans;       //segments retransmitted since the previous collect
+	log2_histogram rtt;     //us
+	log2_histogram retrans_increase; //retrans per connection also seen by the previous collect
+	log2_histogram unacked;
+	log2_histogram delivery_rate;
+};
+
+//one change applied by network_topology
+struct network_topology_event {
+	enum type_t {
+		card_added,
+		card_removed,
+		card_changed,    //state, speed or name
+		address_added,
+		address_removed
+	} type;
+	uint32_t ifindex;
+	std::string name;
+	std::string address; //for address events
+};
+
 //key is card name, value.first is recive bytes, value.second is transmit bytes.
 using card_flow = std::unordered_map<std::string, std::pair<uint64_t, uint64_t>>;
 using card_name = std::unordered_set<std::string>;
 
+//counters of one card from IFLA_STATS64 or /proc/net/dev
+struct card_counter {
+	char name[16]; //IFNAMSIZ
+	uint32_t ifindex; //0 when read from /proc/net/dev
+	bool is_physics; //false for lo, veth, bridge ... whose traffic is counted on a physical card too
+	uint64_t receive_bytes;
+	uint64_t receive_packets;
+	uint64_t receive_errs;
+	uint64_t receive_drop;
+	uint64_t transmit_bytes;
+	uint64_t transmit_packets;
+	uint64_t transmit_errs;
+	uint64_t transmit_drop;
+};
+
+//per second rates of one card between two counters
+struct card_rate {
+	char name[16];
+	uint32_t ifindex;
+	bool reset; //counters went backwards, e.g. the card was recreated, rates of this interval are 0
+	double receive_bytes;
+	double receive_packets;
+	double receive_errs;
+	double receive_drop;
+	double transmit_bytes;
+	double transmit_packets;
+	double transmit_errs;
+	double transmit_drop;
+};
+
+enum class pressure_resource {
+	cpu,
+	memory,
+	io
+};
+
+enum class pressure_kind {
+	some, //at least one task stalled
+	full  //all non-idle tasks stalled
+};
+
+//one line of a PSI file, avg is the stalled percentage, total is stalled microseconds
+struct pressure_stall {
+	double avg10;
+	double avg60;
+	double avg300;
+	uint64_t total;
+};
+
+struct pressure_info {
+	pressure_stall some;
+	pressure_stall full;
+};
+
 struct disk_info {
     uint64_t total_size;
     uint64_t available_size;
 };
 
+
+//collectors of host_snapshot, combine with |
+enum collector : uint32_t {
+	collect_cpu = 1u << 0,      //aggregate cpu line of /proc/stat
+	collect_cpu_core = 1u << 1, //every cpuN line, also fills cpu
+	collect_memory = 1u << 2,
+	collect_network = 1u << 3,
+	collect_disk = 1u << 4,     //statfs of each path preset in host_snapshot::disks
+	collect_pressure = 1u << 5,
+	collect_all = 0x3f
+};
+
+//one time coherent sample of several collectors.
+//reuse it across samples, the vectors keep their capacity so refilling does not allocate.
+struct host_snapshot {
+	uint32_t collected;    //collectors filled without error
+	uint64_t timestamp_ns; //CLOCK_MONOTONIC, taken once for all collectors
+	cpu_occupy cpu;
+	cpu_core_occupy cpu_core;
+	memory_info memory;
+	std::vector<card_counter> network;
+	std::vector<std::pair<std::string, disk_info>> disks;
+	pressure_info cpu_pressure;
+	pressure_info memory_pressure;
+	pressure_info io_pressure;
+};
+
 }
 }
@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <codecvt>
 #include <vector>
+#include <array>
+#include <map>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
@@ -10,6 +12,13 @@
 #include <system_error>
 #include <future>
 #include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include <thread>
 
 #include <unistd.h>
 #include <string.h>
@@ -21,11 +30,25 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <time.h>
 #include <linux/types.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
 
 #include "host_handle.hpp"
+#include "proc_reader.hpp"
+#include "netlink.hpp"
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 14
 #include <sched.h>
@@ -98,83 +121,331 @@ inline std::string get_hostname(std::error_code& ec) {
     return std::string(hostname);
 }
 
+inline void parse_cpu_occupy(std::string_view line, cpu_occupy& occupy) {
+    occupy.user = parse_uint(line);
+    occupy.nice = parse_uint(line);
+    occupy.system = parse_uint(line);
+    occupy.idle = parse_uint(line);
+    occupy.iowait = parse_uint(line);
+    occupy.irq = parse_uint(line);
+    occupy.softirq = parse_uint(line);
+    occupy.steal = parse_uint(line);
+    occupy.guest = parse_uint(line);
+    occupy.guest_nice = parse_uint(line);
+}
+
 inline cpu_occupy get_cpu_occupy(std::error_code& ec) {
     ec.clear();
-    FILE* fd = fopen("/proc/stat", "r");
-    if (fd == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return {};
-    }
+    thread_local proc_reader reader("/proc/stat");
+    char buf[512];
     cpu_occupy occupy{};
-    char buff[256] = { 0 };
-    while (fgets(buff, sizeof(buff), fd)) {
-        sscanf(buff, "%s %llu %llu %llu %llu",
-            occupy.name, &occupy.user, &occupy.nice, &occupy.system, &occupy.idle);
-
-        if (!strcmp("cpu", occupy.name)) {
-            break;
+    reader.for_each_line(buf, [&occupy](std::string_view line) {
+        auto name = next_token(line);
+        if (name != "cpu") {
+            return true;
         }
-        memset(buff, 0, sizeof(buff));
+        parse_cpu_occupy(line, occupy);
+        return false;
+    }, ec);
+    if (ec) {
+        return {};
     }
-    fclose(fd);
     return occupy;
 }
 
+//guest and guest_nice are already counted in user and nice
+inline uint64_t cpu_total_time(const cpu_occupy& occupy) {
+    return occupy.user + occupy.nice + occupy.system + occupy.idle +
+        occupy.iowait + occupy.irq + occupy.softirq + occupy.steal;
+}
+
 inline int32_t calculate_cpu_usage(const cpu_occupy& pre, const cpu_occupy& now)
 {
-    uint64_t pre_total = pre.user + pre.nice + pre.system + pre.idle;
-    uint64_t now_total = now.user + now.nice + now.system + now.idle;
-    auto total_detal = now_total - pre_total;
-    auto used_detal = now.user + pre.system - pre.user - pre.system;
-    if (total_detal == 0) {
+    auto pre_total = cpu_total_time(pre);
+    auto now_total = cpu_total_time(now);
+    auto pre_used = pre_total - pre.idle - pre.iowait;
+    auto now_used = now_total - now.idle - now.iowait;
+    if (now_total <= pre_total) {
         return {};
     }
+    auto total_detal = now_total - pre_total;
+    auto used_detal = now_used > pre_used ? now_used - pre_used : 0;
 
     int usage = (int32_t)ceil((double)(used_detal) * 100 / (double)(total_detal));
     return usage;
 }
 
-inline int32_t get_memory_usage(std::error_code& ec) {
+//fill occupy in place, a reused snapshot keeps its capacity so sampling does not allocate
+inline void get_cpu_core_occupy(cpu_core_occupy& occupy, std::error_code& ec) {
     ec.clear();
-    memory_info meminfo{};
-    FILE* fp = fopen("/proc/meminfo", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return {};
+    occupy.clear();
+    thread_local proc_reader reader("/proc/stat");
+    char buf[512];
+    reader.for_each_line(buf, [&occupy](std::string_view line) {
+        auto name = next_token(line);
+        if (name.compare(0, 3, "cpu") != 0) {
+            return false; //cpu lines come first, stop before the long intr line
+        }
+        if (name.size() == 3) {
+            parse_cpu_occupy(line, occupy.total);
+            return true;
+        }
+        name.remove_prefix(3);
+        cpu_occupy core{};
+        parse_cpu_occupy(line, core);
+        occupy.core.push_back(static_cast<uint32_t>(parse_uint(name)));
+        occupy.user.push_back(core.user);
+        occupy.nice.push_back(core.nice);
+        occupy.system.push_back(core.system);
+        occupy.idle.push_back(core.idle);
+        occupy.iowait.push_back(core.iowait);
+        occupy.irq.push_back(core.irq);
+        occupy.softirq.push_back(core.softirq);
+        occupy.steal.push_back(core.steal);
+        occupy.guest.push_back(core.guest);
+        occupy.guest_nice.push_back(core.guest_nice);
+        return true;
+    }, ec);
+    if (ec) {
+        occupy.clear();
     }
-    char name[256] = { 0 };
-    char buf[256] = { 0 };
-    char unit[32] = { 0 };
-    uint16_t ok = 0;
-    while (fgets(buf, sizeof(buf), fp)) {
-        uint64_t data;
-        sscanf(buf, "%s %llu %s", name, &data, unit);
-        if (!strcmp("MemTotal:", name)) {
-            meminfo.total = data;
-            ok = ok | (uint16_t)0x0001;
+}
+
+inline cpu_core_occupy get_cpu_core_occupy(std::error_code& ec) {
+    cpu_core_occupy occupy{};
+    get_cpu_core_occupy(occupy, ec);
+    return occupy;
+}
+
+//out[i] = (now[i] - pre[i]) * scale[i], counters going backwards count as 0. kept branch free to vectorize.
+inline void calculate_cpu_field_usage(const uint64_t* __restrict pre, const uint64_t* __restrict now,
+    const double* __restrict scale, double* __restrict out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        auto detal = now[i] > pre[i] ? now[i] - pre[i] : 0;
+        out[i] = (double)detal * scale[i];
+    }
+}
+
+inline void calculate_cpu_core_usage(
+    const cpu_core_occupy& pre, const cpu_core_occupy& now, cpu_core_usage& usage)
+{
+    //cpu hotplug changes the core list, line pre up with now and treat new cores as idle
+    const cpu_core_occupy* base = &pre;
+    cpu_core_occupy aligned;
+    if (pre.core != now.core) {
+        aligned = now;
+        std::unordered_map<uint32_t, size_t> index;
+        for (size_t i = 0; i < pre.size(); i++) {
+            index.emplace(pre.core[i], i);
+        }
+        for (size_t i = 0; i < now.size(); i++) {
+            auto it = index.find(now.core[i]);
+            if (it == index.end()) {
+                continue;
+            }
+            auto j = it->second;
+            aligned.user[i] = pre.user[j];
+            aligned.nice[i] = pre.nice[j];
+            aligned.system[i] = pre.system[j];
+            aligned.idle[i] = pre.idle[j];
+            aligned.iowait[i] = pre.iowait[j];
+            aligned.irq[i] = pre.irq[j];
+            aligned.softirq[i] = pre.softirq[j];
+            aligned.steal[i] = pre.steal[j];
         }
-        else if (!strcmp("MemFree:", name)) {
-            meminfo.free = data;
-            ok = ok | (uint16_t)0x0010;
+        base = &aligned;
+    }
+
+    auto n = now.size();
+    usage.core = now.core;
+    for (auto column : { &usage.user, &usage.nice, &usage.system, &usage.idle,
+        &usage.iowait, &usage.irq, &usage.softirq, &usage.steal, &usage.usage }) {
+        column->resize(n);
+    }
+
+    //usage.usage holds 100 / total_detal until the end
+    auto scale = usage.usage.data();
+    for (size_t i = 0; i < n; i++) {
+        auto pre_total = base->user[i] + base->nice[i] + base->system[i] + base->idle[i] +
+            base->iowait[i] + base->irq[i] + base->softirq[i] + base->steal[i];
+        auto now_total = now.user[i] + now.nice[i] + now.system[i] + now.idle[i] +
+            now.iowait[i] + now.irq[i] + now.softirq[i] + now.steal[i];
+        auto total_detal = now_total > pre_total ? now_total - pre_total : 0;
+        scale[i] = total_detal != 0 ? 100.0 / (double)total_detal : 0.0;
+    }
+    calculate_cpu_field_usage(base->user.data(), now.user.data(), scale, usage.user.data(), n);
+    calculate_cpu_field_usage(base->nice.data(), now.nice.data(), scale, usage.nice.data(), n);
+    calculate_cpu_field_usage(base->system.data(), now.system.data(), scale, usage.system.data(), n);
+    calculate_cpu_field_usage(base->idle.data(), now.idle.data(), scale, usage.idle.data(), n);
+    calculate_cpu_field_usage(base->iowait.data(), now.iowait.data(), scale, usage.iowait.data(), n);
+    calculate_cpu_field_usage(base->irq.data(), now.irq.data(), scale, usage.irq.data(), n);
+    calculate_cpu_field_usage(base->softirq.data(), now.softirq.data(), scale, usage.softirq.data(), n);
+    calculate_cpu_field_usage(base->steal.data(), now.steal.data(), scale, usage.steal.data(), n);
+    for (size_t i = 0; i < n; i++) {
+        auto busy = (scale[i] != 0.0 ? 100.0 : 0.0) - usage.idle[i] - usage.iowait[i];
+        usage.usage[i] = busy > 0.0 ? busy : 0.0;
+    }
+}
+
+inline cpu_core_usage calculate_cpu_core_usage(const cpu_core_occupy& pre, const cpu_core_occupy& now) {
+    cpu_core_usage usage{};
+    calculate_cpu_core_usage(pre, now, usage);
+    return usage;
+}
+
+constexpr uint32_t meminfo_hash(std::string_view name) {
+    uint32_t hash = 2166136261u; //FNV-1a
+    for (auto c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+struct meminfo_key {
+    std::string_view name;
+    uint64_t memory_info::* field;
+    uint32_t hash;
+
+    constexpr meminfo_key(std::string_view name, uint64_t memory_info::* field)
+        : name(name), field(field), hash(meminfo_hash(name)) {}
+};
+
+inline constexpr meminfo_key meminfo_keys[] = {
+    { "MemTotal", &memory_info::total },
+    { "MemFree", &memory_info::free },
+    { "MemAvailable", &memory_info::available },
+    { "Buffers", &memory_info::buffers },
+    { "Cached", &memory_info::cached },
+    { "SwapCached", &memory_info::swap_cached },
+    { "Active", &memory_info::active },
+    { "Inactive", &memory_info::inactive },
+    { "Active(anon)", &memory_info::active_anon },
+    { "Inactive(anon)", &memory_info::inactive_anon },
+    { "Active(file)", &memory_info::active_file },
+    { "Inactive(file)", &memory_info::inactive_file },
+    { "Unevictable", &memory_info::unevictable },
+    { "Mlocked", &memory_info::mlocked },
+    { "HighTotal", &memory_info::high_total },
+    { "HighFree", &memory_info::high_free },
+    { "LowTotal", &memory_info::low_total },
+    { "LowFree", &memory_info::low_free },
+    { "MmapCopy", &memory_info::mmap_copy },
+    { "SwapTotal", &memory_info::swap_total },
+    { "SwapFree", &memory_info::swap_free },
+    { "Zswap", &memory_info::zswap },
+    { "Zswapped", &memory_info::zswapped },
+    { "Dirty", &memory_info::dirty },
+    { "Writeback", &memory_info::writeback },
+    { "AnonPages", &memory_info::anon_pages },
+    { "Mapped", &memory_info::mapped },
+    { "Shmem", &memory_info::shmem },
+    { "KReclaimable", &memory_info::kreclaimable },
+    { "Slab", &memory_info::slab },
+    { "SReclaimable", &memory_info::sreclaimable },
+    { "SUnreclaim", &memory_info::sunreclaim },
+    { "KernelStack", &memory_info::kernel_stack },
+    { "ShadowCallStack", &memory_info::shadow_call_stack },
+    { "PageTables", &memory_info::page_tables },
+    { "SecPageTables", &memory_info::sec_page_tables },
+    { "Quicklists", &memory_info::quicklists },
+    { "NFS_Unstable", &memory_info::nfs_unstable },
+    { "Bounce", &memory_info::bounce },
+    { "WritebackTmp", &memory_info::writeback_tmp },
+    { "CommitLimit", &memory_info::commit_limit },
+    { "Committed_AS", &memory_info::committed_as },
+    { "VmallocTotal", &memory_info::vmalloc_total },
+    { "VmallocUsed", &memory_info::vmalloc_used },
+    { "VmallocChunk", &memory_info::vmalloc_chunk },
+    { "Percpu", &memory_info::percpu },
+    { "HardwareCorrupted", &memory_info::hardware_corrupted },
+    { "AnonHugePages", &memory_info::anon_huge_pages },
+    { "ShmemHugePages", &memory_info::shmem_huge_pages },
+    { "ShmemPmdMapped", &memory_info::shmem_pmd_mapped },
+    { "FileHugePages", &memory_info::file_huge_pages },
+    { "FilePmdMapped", &memory_info::file_pmd_mapped },
+    { "CmaTotal", &memory_info::cma_total },
+    { "CmaFree", &memory_info::cma_free },
+    { "Unaccepted", &memory_info::unaccepted },
+    { "Balloon", &memory_info::balloon },
+    { "HugePages_Total", &memory_info::huge_pages_total },
+    { "HugePages_Free", &memory_info::huge_pages_free },
+    { "HugePages_Rsvd", &memory_info::huge_pages_rsvd },
+    { "HugePages_Surp", &memory_info::huge_pages_surp },
+    { "Hugepagesize", &memory_info::huge_page_size },
+    { "Hugetlb", &memory_info::hugetlb },
+    { "DirectMap4k", &memory_info::direct_map_4k },
+    { "DirectMap2M", &memory_info::direct_map_2m },
+    { "DirectMap4M", &memory_info::direct_map_4m },
+    { "DirectMap1G", &memory_info::direct_map_1g },
+};
+
+//open addressing index from key hash to meminfo_keys, built at compile time,
+//so a line is matched by hashing its key once and comparing the key on a hash hit.
+inline constexpr size_t meminfo_slots = 256;
+inline constexpr auto meminfo_index = [] {
+    std::array<uint8_t, meminfo_slots> index{};
+    for (auto& slot : index) {
+        slot = 0xff;
+    }
+    for (size_t i = 0; i < std::size(meminfo_keys); i++) {
+        auto slot = meminfo_keys[i].hash % meminfo_slots;
+        while (index[slot] != 0xff) {
+            slot = (slot + 1) % meminfo_slots;
         }
-        else if (!strcmp("Buffers:", name)) {
-            meminfo.buffers = data;
-            ok = ok | (uint16_t)0x0100;
+        index[slot] = static_cast<uint8_t>(i);
+    }
+    return index;
+}();
+
+constexpr bool meminfo_hash_unique() {
+    for (size_t i = 0; i < std::size(meminfo_keys); i++) {
+        for (size_t j = i + 1; j < std::size(meminfo_keys); j++) {
+            if (meminfo_keys[i].hash == meminfo_keys[j].hash) {
+                return false;
+            }
         }
-        else if (!strcmp("Cached:", name)) {
-            meminfo.cached = data;
-            ok = ok | (uint16_t)0x1000;
+    }
+    return true;
+}
+static_assert(std::size(meminfo_keys) < meminfo_slots / 2, "meminfo index is too full");
+static_assert(meminfo_hash_unique(), "meminfo key hash collides");
+
+inline uint64_t* meminfo_field(memory_info& info, std::string_view name) {
+    auto hash = meminfo_hash(name);
+    for (auto slot = hash % meminfo_slots; meminfo_index[slot] != 0xff; slot = (slot + 1) % meminfo_slots) {
+        auto& key = meminfo_keys[meminfo_index[slot]];
+        if (key.hash == hash && key.name == name) { //an unknown key may share the hash
+            return &(info.*key.field);
         }
+    }
+    return nullptr;
+}
 
-        if (ok == (uint16_t)0x1111) {
-            break; //find all key
+inline memory_info get_memory_info(std::error_code& ec) {
+    ec.clear();
+    thread_local proc_reader reader("/proc/meminfo");
+    char buf[256];
+    memory_info meminfo{};
+    reader.for_each_line(buf, [&meminfo](std::string_view line) {
+        auto pos = line.find(':'); //MemTotal:       16316412 kB
+        if (pos == std::string_view::npos) {
+            return true;
         }
-        memset(name, 0, sizeof(name));
-        memset(buf, 0, sizeof(buf));
-        memset(unit, 0, sizeof(unit));
+        auto field = meminfo_field(meminfo, line.substr(0, pos));
+        if (field != nullptr) {
+            line.remove_prefix(pos + 1);
+            *field = parse_uint(line);
+        }
+        return true;
+    }, ec);
+    if (ec) {
+        return {};
     }
-    fclose(fp);
+    return meminfo;
+}
 
+inline int32_t calculate_memory_usage(const memory_info& meminfo) {
     auto used = meminfo.total - meminfo.free - meminfo.buffers - meminfo.cached;
     if (meminfo.total == 0) {
         return {};
@@ -183,22 +454,280 @@ inline int32_t get_memory_usage(std::error_code& ec) {
     return mem_usage;
 }
 
+inline int32_t get_memory_usage(std::error_code& ec) {
+    auto meminfo = get_memory_info(ec);
+    if (ec) {
+        return {};
+    }
+    return calculate_memory_usage(meminfo);
+}
+
+inline const char* pressure_file(pressure_resource resource) {
+    switch (resource) {
+    case pressure_resource::cpu:
+        return "/proc/pressure/cpu";
+    case pressure_resource::memory:
+        return "/proc/pressure/memory";
+    default:
+        return "/proc/pressure/io";
+    }
+}
+
+//some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+inline void parse_pressure_stall(std::string_view line, pressure_stall& stall) {
+    while (!line.empty()) {
+        auto token = next_token(line);
+        auto pos = token.find('=');
+        if (pos == std::string_view::npos) {
+            continue;
+        }
+        auto key = token.substr(0, pos);
+        auto value = token.substr(pos + 1);
+        if (key == "total") {
+            stall.total = parse_uint(value);
+            continue;
+        }
+        //avg is always printed as %lu.%02lu
+        double avg = (double)parse_uint(value);
+        if (!value.empty() && value[0] == '.') {
+            value.remove_prefix(1);
+            auto digits = value.size();
+            auto fraction = (double)parse_uint(value);
+            avg += fraction / pow(10.0, (double)(digits - value.size()));
+        }
+        if (key == "avg10") {
+            stall.avg10 = avg;
+        }
+        else if (key == "avg60") {
+            stall.avg60 = avg;
+        }
+        else if (key == "avg300") {
+            stall.avg300 = avg;
+        }
+    }
+}
+
+//file is /proc/pressure/<resource> or a cgroup v2 <resource>.pressure file
+inline pressure_info get_pressure_info(const std::string& file, std::error_code& ec) {
+    ec.clear();
+    thread_local proc_reader_cache readers("", "");
+    char buf[256];
+    pressure_info info{};
+    readers.get(file).for_each_line(buf, [&info](std::string_view line) {
+        auto kind = next_token(line);
+        if (kind == "some") {
+            parse_pressure_stall(line, info.some);
+        }
+        else if (kind == "full") {
+            parse_pressure_stall(line, info.full);
+        }
+        return true;
+    }, ec);
+    if (ec) {
+        readers.erase(file);
+        return {};
+    }
+    return info;
+}
+
+inline pressure_info get_pressure_info(pressure_resource resource, std::error_code& ec) {
+    thread_local const std::string files[] = {
+        pressure_file(pressure_resource::cpu),
+        pressure_file(pressure_resource::memory),
+        pressure_file(pressure_resource::io)
+    };
+    return get_pressure_info(files[static_cast<size_t>(resource)], ec);
+}
+
+struct pressure_trigger {
+    int id;
+    std::string file;
+    pressure_kind kind;
+    std::chrono::microseconds stall;
+    std::chrono::microseconds window;
+};
+
+//PSI triggers registered on one epoll fd. the epoll fd can be added to the caller's own
+//epoll loop through native_handle(), it becomes readable when any trigger fires.
+class pressure_monitor {
+private:
+    struct trigger_handle {
+        pressure_trigger trigger;
+        int fd;
+        uint32_t serial; //tells events of a removed trigger from the one reusing its slot
+    };
+
+    int epfd_ = -1;
+    uint32_t serial_ = 0;
+    std::vector<trigger_handle> triggers_; //ids are slots, reused once removed
+
+public:
+    pressure_monitor() = default;
+
+    ~pressure_monitor() { release(); }
+
+    pressure_monitor(const pressure_monitor&) = delete;
+    pressure_monitor& operator=(const pressure_monitor&) = delete;
+
+    pressure_monitor(pressure_monitor&& m) noexcept
+        : epfd_(m.epfd_), serial_(m.serial_), triggers_(std::move(m.triggers_)) {
+        m.epfd_ = -1;
+        m.triggers_.clear();
+    }
+
+    pressure_monitor& operator=(pressure_monitor&& m) noexcept {
+        if (this != &m) {
+            release();
+            epfd_ = m.epfd_;
+            serial_ = m.serial_;
+            triggers_ = std::move(m.triggers_);
+            m.epfd_ = -1;
+            m.triggers_.clear();
+        }
+        return *this;
+    }
+
+    int native_handle() const { return epfd_; }
+
+    //fire when tasks stall for more than stall within any window, e.g. memory some 150ms in 1s.
+    //the kernel needs 500ms <= window <= 10s, unprivileged users need a multiple of 2s.
+    //return the trigger id, or -1 on error.
+    int add_trigger(const std::string& file, pressure_kind kind,
+        std::chrono::microseconds stall, std::chrono::microseconds window, std::error_code& ec)
+    {
+        ec.clear();
+        if (epfd_ == -1) {
+            epfd_ = epoll_create1(EPOLL_CLOEXEC);
+            if (epfd_ == -1) {
+                ec = std::error_code(errno, std::system_category());
+                return -1;
+            }
+        }
+
+        auto fd = open(file.data(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return -1;
+        }
+        char request[64]{};
+        auto len = snprintf(request, sizeof(request), "%s %lld %lld",
+            kind == pressure_kind::some ? "some" : "full",
+            (long long)stall.count(), (long long)window.count());
+        if (write(fd, request, len + 1) < 0) {
+            ec = std::error_code(errno, std::system_category());
+            close(fd);
+            return -1;
+        }
+
+        auto slot = std::find_if(triggers_.begin(), triggers_.end(), [](const trigger_handle& h) { return h.fd == -1; });
+        auto id = static_cast<int>(slot - triggers_.begin());
+        auto serial = ++serial_;
+        struct epoll_event event {};
+        event.events = EPOLLPRI;
+        event.data.u64 = (static_cast<uint64_t>(serial) << 32) | static_cast<uint32_t>(id);
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+            ec = std::error_code(errno, std::system_category());
+            close(fd);
+            return -1;
+        }
+        trigger_handle handle{ { id, file, kind, stall, window }, fd, serial };
+        if (slot == triggers_.end()) {
+            triggers_.push_back(std::move(handle));
+        }
+        else {
+            *slot = std::move(handle);
+        }
+        return id;
+    }
+
+    int add_trigger(pressure_resource resource, pressure_kind kind,
+        std::chrono::microseconds stall, std::chrono::microseconds window, std::error_code& ec)
+    {
+        return add_trigger(pressure_file(resource), kind, stall, window, ec);
+    }
+
+    void remove_trigger(int id) {
+        if (id < 0 || static_cast<size_t>(id) >= triggers_.size()) {
+            return;
+        }
+        auto& handle = triggers_[id];
+        if (handle.fd != -1) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, handle.fd, nullptr);
+            close(handle.fd);
+            handle.fd = -1;
+        }
+    }
+
+    //wait until triggers fire or timeout, f is called with a copy of each fired pressure_trigger,
+    //so f may add or remove triggers. a trigger whose cgroup has gone away is removed.
+    //return the number of fired triggers.
+    template<typename F>
+    size_t wait(std::chrono::milliseconds timeout, F&& f, std::error_code& ec) {
+        ec.clear();
+        if (epfd_ == -1) {
+            ec = std::make_error_code(std::errc::bad_file_descriptor);
+            return 0;
+        }
+
+        constexpr int max_events = 16;
+        struct epoll_event events[max_events];
+        auto n = epoll_wait(epfd_, events, max_events, static_cast<int>(timeout.count()));
+        if (n < 0) {
+            if (errno != EINTR) {
+                ec = std::error_code(errno, std::system_category());
+            }
+            return 0;
+        }
+
+        size_t fired = 0;
+        for (int i = 0; i < n; i++) {
+            auto id = static_cast<int>(events[i].data.u64 & 0xffffffff);
+            auto serial = static_cast<uint32_t>(events[i].data.u64 >> 32);
+            if (triggers_[id].fd == -1 || triggers_[id].serial != serial) { //removed by f for an earlier event
+                continue;
+            }
+            if (events[i].events & EPOLLERR) {
+                remove_trigger(id);
+                continue;
+            }
+            if (events[i].events & EPOLLPRI) {
+                const pressure_trigger trigger = triggers_[id].trigger; //add_trigger in f may move triggers_
+                f(trigger);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+private:
+    void release() {
+        for (auto& handle : triggers_) {
+            if (handle.fd != -1) {
+                close(handle.fd);
+            }
+        }
+        triggers_.clear();
+        if (epfd_ != -1) {
+            close(epfd_);
+            epfd_ = -1;
+        }
+    }
+};
+
 inline card_state get_network_card_state(const std::string& card_name, std::error_code& ec) {
     ec.clear();
-    auto file = "/sys/class/net/" + card_name + "/operstate";
-    FILE* fp = fopen(file.data(), "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
+    thread_local proc_reader_cache readers("/sys/class/net/", "/operstate");
+    char buf[64];
+    auto state = readers.get(card_name).read(buf, ec);
+    if (ec) {
+        readers.erase(card_name);
         return card_state::unknown;
     }
 
-    char buf[64] = { 0 };
-    fgets(buf, sizeof(buf), fp);
-    fclose(fp);
-    if (strncasecmp(buf, "up", 2) == 0) {
+    if (strncasecmp(state.data(), "up", 2) == 0) {
         return card_state::up;
     }
-    if (strncasecmp(buf, "down", 4) == 0) {
+    if (strncasecmp(state.data(), "down", 4) == 0) {
         return card_state::down;
     }
     return card_state::unknown;
@@ -210,15 +739,17 @@ inline uint32_t get_network_card_speed(const std::string& card_name, std::error_
         return 1000 * 40;
     }
 
-    auto file = "/sys/class/net/" + card_name + "/speed";
-    FILE* fp = fopen(file.data(), "r");
-    if (fp == nullptr) {
-        //ec = std::error_code(errno, std::system_category());
+    thread_local proc_reader_cache readers("/sys/class/net/", "/speed");
+    auto& reader = readers.get(card_name);
+    std::error_code ig;
+    reader.open(ig);
+    if (ig) {
+        //ec = ig;
+        readers.erase(card_name);
         return 1000 * 10;
     }
-    char buf[64] = { 0 };
-    fgets(buf, sizeof(buf), fp);
-    fclose(fp);
+    char buf[64];
+    reader.read(buf, ig); //speed of a down card is not readable
     return atoi(buf);
 };
 
@@ -246,296 +777,646 @@ inline bool is_physics(const std::string& network_card_name) {
 inline auto get_route_table(std::error_code& ec) {
     ec.clear();
     std::vector<std::vector<std::string>> tables;
-    FILE* fp = fopen("/proc/net/route", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return tables;
-    }
+    thread_local proc_reader reader("/proc/net/route");
 
     constexpr size_t count = 11;
-    char buf[1024]{};
-    char name[count][32]{};
-    fgets(buf, sizeof(buf), fp);
-    sscanf(buf, "%s %s %s %s %s %s %s %s %s %s %s", name[0], name[1], name[2],
-           name[3], name[4], name[5], name[6], name[7], name[8], name[9], name[10]);
+    char buf[1024];
     std::vector<std::string> table;
-    table.reserve(count);
-    for (size_t i = 0; i < count; i++) {
-        table.emplace_back(name[i]);
-    }
-    tables.emplace_back(std::move(table));
-
-    while (fgets(buf, sizeof(buf), fp)) {
-        char Iface[128]{};
-        uint32_t Destination = 0;
-        uint32_t Gateway = 0;
-        char Flags[128]{};
-        char RefCnt[128]{};
-        char Use[128]{};
-        char Metric[128]{};
-        uint32_t Mask = 0;
-        char MTU[128]{};
-        char Window[128]{};
-        char IRTT[128]{};
-        sscanf(buf, "%s %X %X %s %s %s %s %X %s %s %s",
-               Iface, &Destination, &Gateway, Flags, RefCnt, Use, Metric, &Mask, MTU, Window, IRTT);
+    reader.for_each_line(buf, [&tables, &table](std::string_view line) {
+        if (tables.empty()) { //header
+            table.reserve(count);
+            for (size_t i = 0; i < count; i++) {
+                table.emplace_back(next_token(line));
+            }
+            tables.emplace_back(std::move(table));
+            return true;
+        }
 
+        auto Iface = next_token(line);
+        auto Destination = static_cast<uint32_t>(parse_hex(line));
+        auto Gateway = static_cast<uint32_t>(parse_hex(line));
+        auto Flags = next_token(line);
+        auto RefCnt = next_token(line);
+        auto Use = next_token(line);
+        auto Metric = next_token(line);
+        auto Mask = static_cast<uint32_t>(parse_hex(line));
+        auto MTU = next_token(line);
+        auto Window = next_token(line);
+        auto IRTT = next_token(line);
+
+        char address[INET_ADDRSTRLEN]{};
         table.emplace_back(Iface);
-        struct in_addr inAddr {};
-        inAddr.s_addr = Destination;
-        table.emplace_back(inet_ntoa(inAddr));
-        inAddr.s_addr = Gateway;
-        table.emplace_back(inet_ntoa(inAddr));
+        inet_ntop(AF_INET, &Destination, address, sizeof(address));
+        table.emplace_back(address);
+        inet_ntop(AF_INET, &Gateway, address, sizeof(address));
+        table.emplace_back(address);
         table.emplace_back(Flags);
         table.emplace_back(RefCnt);
         table.emplace_back(Use);
         table.emplace_back(Metric);
-        inAddr.s_addr = Mask;
-        table.emplace_back(inet_ntoa(inAddr));
+        inet_ntop(AF_INET, &Mask, address, sizeof(address));
+        table.emplace_back(address);
         table.emplace_back(MTU);
         table.emplace_back(Window);
         table.emplace_back(IRTT);
         tables.emplace_back(std::move(table));
-
-        memset(buf, 0, sizeof(buf));
-    }
-    fclose(fp);
+        return true;
+    }, ec);
     return tables;
 }
 
 inline auto get_route_table_ipv4() {
     std::unordered_map<std::string, std::string> tables;
-    FILE* fp = fopen("/proc/net/route", "r");
-    if (fp == nullptr) {
+    thread_local proc_reader reader("/proc/net/route");
+    std::error_code ec;
+    reader.open(ec);
+    if (ec) {
         return tables;
     }
 
     auto virtual_cards = get_virtual_network_card();
-    char interface[128]{};
-    char buf[1024]{};
-    uint32_t dest = 0;
-    fgets(buf, sizeof(buf), fp);
-    while (fgets(buf, sizeof(buf), fp)) {
-        sscanf(buf, "%s %X", interface, &dest);
-        size_t i = 0;
-        while (interface[i] == ' ') {
-            i++;
-            continue;
+    char buf[1024];
+    bool header = true;
+    std::string name;
+    reader.for_each_line(buf, [&](std::string_view line) {
+        if (header) {
+            header = false;
+            return true;
         }
-        std::string name{ interface + i, strlen(interface + i) };
+        name = next_token(line);
+        auto dest = static_cast<uint32_t>(parse_hex(line));
         if (virtual_cards.find(name) == virtual_cards.end()) { //physics card do not need
-            continue;
+            return true;
         }
 
-        struct in_addr inAddr {};
-        inAddr.s_addr = dest;
-        tables.emplace(name, inet_ntoa(inAddr)); //calico ip just has one 
-        memset(buf, 0, sizeof(buf));
-        memset(interface, 0, sizeof(interface));
-    }
-    fclose(fp);
+        char address[INET_ADDRSTRLEN]{};
+        inet_ntop(AF_INET, &dest, address, sizeof(address));
+        tables.emplace(name, address); //calico ip just has one 
+        return true;
+    }, ec);
     return tables;
 }
 
-inline auto get_network_card_iflink(const std::string& name) {
-    auto file_name = "/sys/class/net/" + name + "/iflink";
-    FILE* fp = fopen(file_name.data(), "r");
-    if (fp == nullptr) {
-        return (uint32_t)0;
+//parse the next hops of RTA_MULTIPATH into one entry each, based on route
+inline void parse_route_multipath(const rtattr* attr, const route_entry& route, std::vector<route_entry>& routes) {
+    auto len = static_cast<int>(RTA_PAYLOAD(attr));
+    auto nh = (const rtnexthop*)RTA_DATA(attr);
+    auto address_size = (route.family == AF_INET) ? 4u : 16u;
+    while (len >= (int)sizeof(rtnexthop) && nh->rtnh_len >= sizeof(rtnexthop) && nh->rtnh_len <= len) {
+        auto entry = route;
+        entry.ifindex = static_cast<uint32_t>(nh->rtnh_ifindex);
+        for_each_rtattr(RTNH_DATA(nh), nh->rtnh_len - sizeof(rtnexthop), [&](const rtattr* nh_attr) {
+            if (nh_attr->rta_type == RTA_GATEWAY && RTA_PAYLOAD(nh_attr) >= address_size) {
+                memcpy(entry.gateway, RTA_DATA(nh_attr), address_size);
+                entry.has_gateway = true;
+            }
+        });
+        routes.push_back(entry);
+        len -= RTNH_ALIGN(nh->rtnh_len);
+        nh = RTNH_NEXT(nh);
     }
-    char buf[8] = { 0 };
-    fgets(buf, sizeof(buf), fp);
-    fclose(fp);
-    return (uint32_t)atoi(buf);
 }
 
-inline auto get_veth_peer_card_iflink() {
-    std::unordered_map<std::string, uint32_t> iflinks;
-    struct nl_req {
+//every route of family (AF_INET, AF_INET6 or AF_UNSPEC for both) in every table from one RTM_GETROUTE dump.
+//routes keeps its capacity between calls.
+inline void get_route_entry(std::vector<route_entry>& routes, uint8_t family, std::error_code& ec) {
+    ec.clear();
+    routes.clear();
+    thread_local netlink_socket socket;
+    struct {
         struct nlmsghdr hdr;
-        struct rtgenmsg gen;
+        struct rtmsg rtm;
+    } req{};
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.hdr.nlmsg_type = RTM_GETROUTE;
+    req.rtm.rtm_family = family;
+    socket.dump(&req.hdr, [&routes](const nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWROUTE || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg))) {
+            return true;
+        }
+        auto rtm = (const struct rtmsg*)NLMSG_DATA(nlh);
+        if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6) {
+            return true;
+        }
+        route_entry route{};
+        route.family = rtm->rtm_family;
+        route.prefix_length = rtm->rtm_dst_len;
+        route.type = rtm->rtm_type;
+        route.protocol = rtm->rtm_protocol;
+        route.scope = rtm->rtm_scope;
+        route.table = rtm->rtm_table;
+        auto address_size = (route.family == AF_INET) ? 4u : 16u;
+        const rtattr* multipath = nullptr;
+        for_each_rtattr(RTM_RTA(rtm), static_cast<uint32_t>(RTM_PAYLOAD(nlh)), [&](const rtattr* attr) {
+            switch (attr->rta_type) {
+            case RTA_DST:
+                memcpy(route.destination, RTA_DATA(attr), std::min<size_t>(RTA_PAYLOAD(attr), address_size));
+                break;
+            case RTA_GATEWAY:
+                memcpy(route.gateway, RTA_DATA(attr), std::min<size_t>(RTA_PAYLOAD(attr), address_size));
+                route.has_gateway = true;
+                break;
+            case RTA_PREFSRC:
+                memcpy(route.source, RTA_DATA(attr), std::min<size_t>(RTA_PAYLOAD(attr), address_size));
+                break;
+            case RTA_OIF:
+                route.ifindex = *((const uint32_t*)RTA_DATA(attr));
+                break;
+            case RTA_PRIORITY:
+                route.metric = *((const uint32_t*)RTA_DATA(attr));
+                break;
+            case RTA_TABLE:
+                route.table = *((const uint32_t*)RTA_DATA(attr));
+                break;
+            case RTA_MULTIPATH:
+                multipath = attr;
+                break;
+            default:
+                break;
+            }
+        });
+        if (multipath != nullptr) {
+            parse_route_multipath(multipath, route, routes);
+        }
+        else {
+            routes.push_back(route);
+        }
+        return true;
+    }, ec);
+}
+
+inline std::vector<route_entry> get_route_entry(uint8_t family, std::error_code& ec) {
+    std::vector<route_entry> routes;
+    get_route_entry(routes, family, ec);
+    return routes;
+}
+
+//longest prefix match over the routes of one table. each family has a binary trie whose nodes sit
+//in one vector, a lookup walks at most 32 (ipv4) or 128 (ipv6) nodes without allocating.
+//of several routes with the same prefix the one with the lowest metric wins, as in the kernel.
+class route_index {
+private:
+    struct node {
+        int32_t child[2] = { -1, -1 };
+        int32_t route = -1;
     };
 
-    struct sockaddr_nl kernel {};
-    kernel.nl_family = AF_NETLINK;
+    std::vector<route_entry> routes_;
+    std::vector<node> nodes_[2]; //ipv4, ipv6
 
-    struct sockaddr_nl local {};
-    local.nl_family = AF_NETLINK;
-    local.nl_pid = getpid();
-    local.nl_groups = 0;
+public:
+    route_index() = default;
 
-    nl_req req{};
-    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
-    req.hdr.nlmsg_type = RTM_GETLINK;
-    req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-    req.hdr.nlmsg_pid = getpid();
-    req.hdr.nlmsg_seq = 1;
-    req.gen.rtgen_family = AF_PACKET;
-
-    struct iovec iov {};
-    iov.iov_base = &req;
-    iov.iov_len = req.hdr.nlmsg_len;
-
-    struct msghdr msg {};
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_name = &kernel;
-    msg.msg_namelen = sizeof(kernel);
-
-    auto fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-    if (fd < 0) {
-        return iflinks;
-    }
-    auto closer = std::shared_ptr<void>(nullptr, [fd](auto) { close(fd); });
-
-    auto ok = bind(fd, (struct sockaddr*)&local, sizeof(local));
-    if (ok < 0) {
-        return iflinks;
-    }
-    sendmsg(fd, (struct msghdr*)&msg, 0);
-
-    memset(&iov, 0, sizeof(iov));
-    constexpr int buf_size = 1024 * 32;
-    char buf[buf_size]{};
-    iov.iov_base = buf;
-    iov.iov_len = buf_size;
-    int64_t msg_len = 0;
-
-    while (true) {
-        msg_len = recvmsg(fd, &msg, 0);
-        if (msg_len < 0) {
-            break;
-        }
-        auto nlmsg_ptr = (struct nlmsghdr*)buf;
-        if (nlmsg_ptr->nlmsg_type == NLMSG_DONE || nlmsg_ptr->nlmsg_type == NLMSG_ERROR) {
-            break;
-        }
+    explicit route_index(const std::vector<route_entry>& routes, uint32_t table = RT_TABLE_MAIN) {
+        build(routes, table);
+    }
 
-        while (NLMSG_OK(nlmsg_ptr, msg_len)) {
-            if (nlmsg_ptr->nlmsg_type == RTM_NEWLINK) {
-                auto ifi_ptr = (struct ifinfomsg*)NLMSG_DATA(nlmsg_ptr);
-                auto attr_ptr = IFLA_RTA(ifi_ptr);
-                auto attr_len = nlmsg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi_ptr));
-               
-                std::string ifname;
-                uint32_t iflink = 0;
-                while (RTA_OK(attr_ptr, attr_len)) {             
-                    if (attr_ptr->rta_type == IFLA_IFNAME) {
-                        ifname = (char*)RTA_DATA(attr_ptr);          
-                    }
-                    if (attr_ptr->rta_type == IFLA_LINK) {
-                        iflink = *((uint32_t*)RTA_DATA(attr_ptr));
-                    }
-                    attr_ptr = RTA_NEXT(attr_ptr, attr_len);                   
+    //index the routes of table, unicast, local and unreachable types alike
+    void build(const std::vector<route_entry>& routes, uint32_t table = RT_TABLE_MAIN) {
+        routes_.clear();
+        for (auto& nodes : nodes_) {
+            nodes.assign(1, node{});
+        }
+        for (const auto& route : routes) {
+            if (route.table != table || route.prefix_length > (route.family == AF_INET ? 32 : 128)) {
+                continue;
+            }
+            auto& nodes = nodes_[route.family == AF_INET ? 0 : 1];
+            int32_t current = 0;
+            for (uint8_t i = 0; i < route.prefix_length; i++) {
+                auto bit = bit_at(route.destination, i);
+                if (nodes[current].child[bit] == -1) {
+                    nodes[current].child[bit] = static_cast<int32_t>(nodes.size());
+                    nodes.emplace_back();
+                }
+                current = nodes[current].child[bit];
+            }
+            auto& slot = nodes[current].route;
+            if (slot == -1 || route.metric < routes_[slot].metric) {
+                if (slot == -1) {
+                    slot = static_cast<int32_t>(routes_.size());
+                    routes_.push_back(route);
                 }
-                if (iflink != 0) {
-                    iflinks.emplace(std::move(ifname), iflink);
+                else {
+                    routes_[slot] = route;
                 }
             }
-            nlmsg_ptr = NLMSG_NEXT(nlmsg_ptr, msg_len);
+        }
+        for (auto& nodes : nodes_) {
+            nodes.shrink_to_fit();
         }
     }
-    return iflinks;
-}
-
-using ipv46_set = std::pair<std::unordered_set<std::string>, std::unordered_set<std::string>>;
-using container_ip_type = std::unordered_map<uint32_t, ipv46_set>;
-inline void get_container_ip_impl(std::error_code& ec, container_ip_type& set) {
-    ec.clear();
-    ifaddrs* ifList{};
-    if (getifaddrs(&ifList) < 0) {
-        ec = std::error_code(errno, std::system_category());
-        return;
-    }
-    auto iflinks = get_veth_peer_card_iflink();
 
-    for (auto ifa = ifList; ifa != nullptr; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == nullptr) {
-            continue;
-        }
-        std::string name = ifa->ifa_name;
-        if (name == "lo" || name == "tunl0") {
-            continue;
+    //route carrying traffic to address, in network byte order, nullptr when nothing matches
+    const route_entry* lookup(uint8_t family, const void* address) const {
+        if (family != AF_INET && family != AF_INET6) {
+            return nullptr;
         }
-        auto it = iflinks.find(name);
-        if (it == iflinks.end()) {
-            continue;
+        auto& nodes = nodes_[family == AF_INET ? 0 : 1];
+        if (nodes.empty()) {
+            return nullptr;
         }
-
-        auto& [ipv4, ipv6] = set[it->second];
-        if (ifa->ifa_addr->sa_family == AF_INET) {
-            char address_ip[INET_ADDRSTRLEN]{};
-            auto sin = (struct sockaddr_in*)ifa->ifa_addr;
-            inet_ntop(AF_INET, &sin->sin_addr, address_ip, INET_ADDRSTRLEN);
-            if (strncmp("169.254", address_ip, 7) != 0) { //filter Link-local address
-                ipv4.emplace(address_ip);
+        auto bytes = static_cast<const uint8_t*>(address);
+        uint8_t length = (family == AF_INET) ? 32 : 128;
+        int32_t current = 0;
+        int32_t found = nodes[0].route;
+        for (uint8_t i = 0; i < length; i++) {
+            current = nodes[current].child[bit_at(bytes, i)];
+            if (current == -1) {
+                break;
             }
-        }
-        else if (ifa->ifa_addr->sa_family == AF_INET6) {
-            char address_ip[INET6_ADDRSTRLEN]{};
-            auto sin6 = (struct sockaddr_in6*)ifa->ifa_addr;
-            inet_ntop(AF_INET6, &sin6->sin6_addr, address_ip, INET6_ADDRSTRLEN);
-            if (strncmp("fe80", address_ip, 4) != 0) { //filter Link-local address
-                ipv6.emplace(address_ip);
+            if (nodes[current].route != -1) {
+                found = nodes[current].route;
             }
         }
+        return found == -1 ? nullptr : &routes_[found];
     }
-    freeifaddrs(ifList);
-}
-inline auto get_container_ip(std::error_code& ec) {
-    ec.clear();
 
-    //enter a new net namespace may change some thing, so a thread is required.
-    auto result = std::async(std::launch::async, [&ec]() {
-        container_ip_type ip_set;
-        namespace fs = std::filesystem;
-        try {
-            //get net namespace different from process 1.
-            auto process_1_net_ns_flag = fs::read_symlink("/proc/1/ns/net").string();
-            std::set<std::string> new_net_ns;
-            for (const auto& entry : fs::directory_iterator("/proc/")) {
-                auto net = entry.path().string() + "/ns/net";
-                if (!fs::exists(net) || fs::read_symlink(net).string() == process_1_net_ns_flag) {
-                    continue;
-                }
+    const route_entry* lookup(const in_addr& address) const {
+        return lookup(AF_INET, &address);
+    }
 
-                //enter each net namespace to get ip
-                auto fd = open(net.data(), O_RDONLY);
-                if (fd == -1) {
-                    ec = std::error_code(errno, std::system_category());
-                    continue;
-                }
-                auto closer = std::shared_ptr<void>(nullptr, [fd](auto) { close(fd); });
-                if (setns(fd, 0) == -1) {
-                    ec = std::error_code(errno, std::system_category());
-                    continue;
-                }
-                get_container_ip_impl(ec, ip_set);
-            }
+    const route_entry* lookup(const in6_addr& address) const {
+        return lookup(AF_INET6, &address);
+    }
+
+    //address in text form, nullptr when it does not parse
+    const route_entry* lookup(const std::string& address) const {
+        in6_addr binary{};
+        if (inet_pton(AF_INET, address.data(), &binary) == 1) {
+            return lookup(AF_INET, &binary);
         }
-        catch (const fs::filesystem_error& e) {
-            ec = e.code();
+        if (inet_pton(AF_INET6, address.data(), &binary) == 1) {
+            return lookup(AF_INET6, &binary);
         }
-        return ip_set;
-    });
-    return result.get();
-}
+        return nullptr;
+    }
 
-inline network_card_t get_network_card(std::error_code& ec) {
-    ec.clear();
-    ifaddrs* ifList{};
-    if (getifaddrs(&ifList) < 0) {
-        ec = std::error_code(errno, std::system_category());
-        return {};
+    size_t size() const { return routes_.size(); }
+
+    const std::vector<route_entry>& routes() const { return routes_; }
+
+private:
+    static uint32_t bit_at(const uint8_t* bytes, uint8_t i) {
+        return (bytes[i >> 3] >> (7 - (i & 7))) & 1u;
     }
-    auto virtual_cards = get_virtual_network_card();
+};
 
-    bool has_veth_pair_card = false;
-    network_card_t cards;
-    for (auto ifa = ifList; ifa != nullptr; ifa = ifa->ifa_next) {
-        std::string name = ifa->ifa_name;
-        auto it = cards.find(name);
-        if (it == cards.end()) {
+inline auto get_network_card_iflink(const std::string& name) {
+    thread_local proc_reader_cache readers("/sys/class/net/", "/iflink");
+    char buf[16];
+    std::error_code ec;
+    readers.get(name).read(buf, ec);
+    if (ec) {
+        readers.erase(name);
+        return (uint32_t)0;
+    }
+    return (uint32_t)atoi(buf);
+}
+
+//send an RTM_GETLINK dump on socket and call f(const ifinfomsg*, const rtattr* attrs, uint32_t attrs_len)
+template<typename F>
+inline void dump_link(netlink_socket& socket, F&& f, std::error_code& ec) {
+    struct {
+        struct nlmsghdr hdr;
+        struct ifinfomsg ifi;
+    } req{};
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.hdr.nlmsg_type = RTM_GETLINK;
+    req.ifi.ifi_family = AF_PACKET;
+    socket.dump(&req.hdr, [&f](const nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWLINK || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+            return true;
+        }
+        auto ifi = (const struct ifinfomsg*)NLMSG_DATA(nlh);
+        f(ifi, (const rtattr*)IFLA_RTA(ifi), static_cast<uint32_t>(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi))));
+        return true;
+    }, ec);
+}
+
+inline auto get_veth_peer_card_iflink() {
+    std::unordered_map<std::string, uint32_t> iflinks;
+    thread_local netlink_socket socket;
+    std::error_code ec;
+    dump_link(socket, [&iflinks](const ifinfomsg*, const rtattr* attrs, uint32_t len) {
+        std::string_view ifname;
+        uint32_t iflink = 0;
+        for_each_rtattr(attrs, len, [&](const rtattr* attr) {
+            if (attr->rta_type == IFLA_IFNAME) {
+                ifname = (const char*)RTA_DATA(attr);
+            }
+            else if (attr->rta_type == IFLA_LINK) {
+                iflink = *((const uint32_t*)RTA_DATA(attr));
+            }
+        });
+        if (iflink != 0) {
+            iflinks.emplace(ifname, iflink);
+        }
+    }, ec);
+    return iflinks;
+}
+
+//send an RTM_GETADDR dump for family (AF_UNSPEC for all) and call
+//f(const ifaddrmsg*, const rtattr* attrs, uint32_t attrs_len)
+template<typename F>
+inline void dump_addr(netlink_socket& socket, uint8_t family, F&& f, std::error_code& ec) {
+    struct {
+        struct nlmsghdr hdr;
+        struct ifaddrmsg ifa;
+    } req{};
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    req.hdr.nlmsg_type = RTM_GETADDR;
+    req.ifa.ifa_family = family;
+    socket.dump(&req.hdr, [&f](const nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWADDR || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+            return true;
+        }
+        auto ifa = (const struct ifaddrmsg*)NLMSG_DATA(nlh);
+        f(ifa, (const rtattr*)IFA_RTA(ifa), static_cast<uint32_t>(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa))));
+        return true;
+    }, ec);
+}
+
+//address of an RTM_NEWADDR message as text, empty for link-local addresses
+inline std::string_view format_card_address(
+    const ifaddrmsg* ifa, const rtattr* attrs, uint32_t len, char(&buf)[INET6_ADDRSTRLEN])
+{
+    const void* address = nullptr;
+    for_each_rtattr(attrs, len, [&](const rtattr* attr) {
+        //IFA_LOCAL is the address of the card, IFA_ADDRESS is the peer on point to point links
+        if (attr->rta_type == IFA_LOCAL || (attr->rta_type == IFA_ADDRESS && address == nullptr)) {
+            address = RTA_DATA(attr);
+        }
+    });
+    if (address == nullptr || inet_ntop(ifa->ifa_family, address, buf, sizeof(buf)) == nullptr) {
+        return {};
+    }
+    std::string_view text = buf;
+    if ((ifa->ifa_family == AF_INET && text.substr(0, 7) == "169.254") ||
+        (ifa->ifa_family == AF_INET6 && text.substr(0, 4) == "fe80")) { //filter Link-local address
+        return {};
+    }
+    return text;
+}
+
+using ipv46_set = std::pair<std::unordered_set<std::string>, std::unordered_set<std::string>>;
+using container_ip_type = std::unordered_map<uint32_t, ipv46_set>;
+
+//addresses of veth cards in the current net namespace, keyed by the ifindex of their host side peer.
+//socket must be created in this namespace, a netlink socket stays bound to the namespace it was created in.
+inline void get_container_ip_impl(netlink_socket& socket, container_ip_type& set, std::error_code& ec) {
+    std::unordered_map<uint32_t, uint32_t> peers; //ifindex -> iflink
+    dump_link(socket, [&peers](const ifinfomsg* ifi, const rtattr* attrs, uint32_t len) {
+        std::string_view name;
+        uint32_t iflink = 0;
+        for_each_rtattr(attrs, len, [&](const rtattr* attr) {
+            if (attr->rta_type == IFLA_IFNAME) {
+                name = (const char*)RTA_DATA(attr);
+            }
+            else if (attr->rta_type == IFLA_LINK) {
+                iflink = *((const uint32_t*)RTA_DATA(attr));
+            }
+        });
+        if (iflink != 0 && name != "lo" && name != "tunl0") {
+            peers.emplace(static_cast<uint32_t>(ifi->ifi_index), iflink);
+        }
+    }, ec);
+    if (ec || peers.empty()) {
+        return;
+    }
+
+    dump_addr(socket, AF_UNSPEC, [&](const ifaddrmsg* ifa, const rtattr* attrs, uint32_t len) {
+        auto it = peers.find(ifa->ifa_index);
+        if (it == peers.end()) {
+            return;
+        }
+        char buf[INET6_ADDRSTRLEN];
+        auto address = format_card_address(ifa, attrs, len, buf);
+        if (address.empty()) {
+            return;
+        }
+        auto& [ipv4, ipv6] = set[it->second];
+        if (ifa->ifa_family == AF_INET) {
+            ipv4.emplace(address);
+        }
+        else if (ifa->ifa_family == AF_INET6) {
+            ipv6.emplace(address);
+        }
+    }, ec);
+}
+
+//find addresses of containers by entering each net namespace other than the one of process 1,
+//or of this process when process 1 cannot be inspected.
+//namespaces are found by the inode of /proc/<pid>/ns/net, so each is entered once however many
+//processes share it, and its addresses are cached by inode until it goes away or max_age passes.
+//namespaces are entered on one long-lived worker thread which returns to its own namespace after
+//each, so the threads of the caller never change namespace.
+class container_ip_discovery {
+private:
+    //after fork the child has the handle of a worker which only runs in the parent. it can be
+    //neither joined nor detached, so the handle is leaked and a new worker starts on demand.
+    //tasks queued by parent threads have no waiter in the child.
+    void forget_forked_worker() {
+        if (worker_ && fork_generation_ != get_fork_generation()) {
+            (void)worker_.release();
+            tasks_.clear();
+        }
+    }
+
+    struct namespace_entry {
+        container_ip_type ips;
+        std::chrono::steady_clock::time_point updated;
+        bool seen = false;
+    };
+
+    std::chrono::nanoseconds max_age_;
+    std::unordered_map<ino_t, namespace_entry> cache_;
+    std::unique_ptr<std::thread> worker_;
+    uint32_t fork_generation_ = 0; //of the process that started worker_
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::packaged_task<container_ip_type()>> tasks_;
+    bool stop_ = false;
+
+public:
+    explicit container_ip_discovery(std::chrono::nanoseconds max_age = std::chrono::seconds(60))
+        : max_age_(max_age) {}
+
+    ~container_ip_discovery() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            forget_forked_worker();
+        }
+        cv_.notify_one();
+        if (worker_) {
+            worker_->join();
+        }
+    }
+
+    container_ip_discovery(const container_ip_discovery&) = delete;
+    container_ip_discovery& operator=(const container_ip_discovery&) = delete;
+
+    //addresses of every container keyed by the host side veth ifindex, refreshed on the worker thread
+    container_ip_type discover(std::error_code& ec) {
+        ec.clear();
+        std::packaged_task<container_ip_type()> task([this, &ec] { return refresh(ec); });
+        auto result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            forget_forked_worker();
+            if (!worker_) {
+                fork_generation_ = get_fork_generation();
+                worker_ = std::make_unique<std::thread>([this] { run(); });
+            }
+            tasks_.emplace_back(std::move(task));
+        }
+        cv_.notify_one();
+        return result.get();
+    }
+
+    //forget cached namespaces, the next discover enters every namespace again
+    void clear() {
+        std::packaged_task<container_ip_type()> task([this] { cache_.clear(); return container_ip_type{}; });
+        auto result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            forget_forked_worker();
+            if (!worker_) {
+                cache_.clear();
+                return;
+            }
+            tasks_.emplace_back(std::move(task));
+        }
+        cv_.notify_one();
+        result.wait();
+    }
+
+private:
+    void run() {
+        while (true) {
+            std::vector<std::packaged_task<container_ip_type()>> tasks;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty()) { //stopped
+                    return;
+                }
+                tasks.swap(tasks_);
+            }
+            for (auto& task : tasks) {
+                task();
+            }
+        }
+    }
+
+    container_ip_type refresh(std::error_code& ec) {
+        container_ip_type ips;
+        auto home = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+        if (home == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return ips;
+        }
+        auto home_closer = std::shared_ptr<void>(nullptr, [home](auto) { close(home); });
+        struct stat host_ns {};
+        if (stat("/proc/1/ns/net", &host_ns) != 0 && fstat(home, &host_ns) != 0) { //process 1 may be hidden
+            ec = std::error_code(errno, std::system_category());
+            return ips;
+        }
+        auto proc = opendir("/proc");
+        if (proc == nullptr) {
+            ec = std::error_code(errno, std::system_category());
+            return ips;
+        }
+        auto proc_closer = std::shared_ptr<void>(nullptr, [proc](auto) { closedir(proc); });
+
+        auto now = std::chrono::steady_clock::now();
+        std::string path;
+        while (auto entry = readdir(proc)) {
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+                continue;
+            }
+            path.assign(entry->d_name).append("/ns/net");
+            struct stat ns {};
+            if (fstatat(dirfd(proc), path.data(), &ns, 0) != 0 || ns.st_ino == host_ns.st_ino) {
+                continue; //the process has exited or is not in a container
+            }
+            auto [it, inserted] = cache_.try_emplace(ns.st_ino);
+            auto& cached = it->second;
+            if (cached.seen) {
+                continue;
+            }
+            cached.seen = true;
+            if (!inserted && now - cached.updated < max_age_) {
+                continue;
+            }
+
+            //enter the namespace through this process
+            auto fd = openat(dirfd(proc), path.data(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                continue;
+            }
+            auto closer = std::shared_ptr<void>(nullptr, [fd](auto) { close(fd); });
+            if (setns(fd, CLONE_NEWNET) == -1) {
+                ec = std::error_code(errno, std::system_category());
+                continue;
+            }
+            container_ip_type found;
+            std::error_code dump_ec;
+            {
+                netlink_socket socket;
+                get_container_ip_impl(socket, found, dump_ec);
+            }
+            if (setns(home, CLONE_NEWNET) == -1) { //should never happen, stop before reading the wrong namespace
+                ec = std::error_code(errno, std::system_category());
+                cache_.clear();
+                return {};
+            }
+            if (dump_ec) {
+                ec = dump_ec;
+                continue;
+            }
+            cached.ips = std::move(found);
+            cached.updated = now;
+        }
+
+        for (auto it = cache_.begin(); it != cache_.end();) {
+            if (!it->second.seen) { //namespace has gone
+                it = cache_.erase(it);
+                continue;
+            }
+            it->second.seen = false;
+            for (const auto& [iflink, set] : it->second.ips) {
+                auto& [ipv4, ipv6] = ips[iflink];
+                ipv4.insert(set.first.begin(), set.first.end());
+                ipv6.insert(set.second.begin(), set.second.end());
+            }
+            ++it;
+        }
+        return ips;
+    }
+};
+
+inline auto get_container_ip(std::error_code& ec) {
+    static container_ip_discovery discovery;
+    return discovery.discover(ec);
+}
+
+inline network_card_t get_network_card_ifaddrs(std::error_code& ec) {
+    ec.clear();
+    ifaddrs* ifList{};
+    if (getifaddrs(&ifList) < 0) {
+        ec = std::error_code(errno, std::system_category());
+        return {};
+    }
+    auto virtual_cards = get_virtual_network_card();
+
+    bool has_veth_pair_card = false;
+    network_card_t cards;
+    for (auto ifa = ifList; ifa != nullptr; ifa = ifa->ifa_next) {
+        std::string name = ifa->ifa_name;
+        auto it = cards.find(name);
+        if (it == cards.end()) {
             networkcard card{};
             auto iflink = get_network_card_iflink(name);
             auto ifindex = if_nametoindex(name.data());
@@ -590,49 +1471,428 @@ inline network_card_t get_network_card(std::error_code& ec) {
     return cards;
 }
 
+//virtual cards carry a link kind (veth, bridge, vlan ...) or are loopback, physical cards have a parent
+//device. cards with neither, e.g. on kernels before 5.17, are looked up in /sys/devices/virtual/net.
+inline bool is_physics_link(const std::string& name, unsigned int flags, bool has_kind, bool has_parent) {
+    if (has_kind || (flags & IFF_LOOPBACK) != 0) {
+        return false;
+    }
+    if (has_parent) {
+        return true;
+    }
+    std::error_code ig;
+    return !std::filesystem::exists("/sys/devices/virtual/net/" + name, ig);
+}
+
+//fill card from an RTM_NEWLINK message, iflink is the peer index of a veth, false without a name
+inline bool parse_network_card(
+    const ifinfomsg* ifi, const rtattr* attrs, uint32_t len, networkcard& card, uint32_t& iflink)
+{
+    constexpr unsigned short ifla_parent_dev_name = 56; //IFLA_PARENT_DEV_NAME, linux 5.17
+    constexpr uint8_t if_oper_down = 2; //IF_OPER_DOWN of linux/if.h, which conflicts with net/if.h
+    std::string name;
+    uint8_t operstate = 0;
+    std::string_view kind;
+    bool has_parent = false;
+    iflink = 0;
+    for_each_rtattr(attrs, len, [&](const rtattr* attr) {
+        switch (attr->rta_type) {
+        case IFLA_IFNAME:
+            name = (const char*)RTA_DATA(attr);
+            break;
+        case IFLA_LINK:
+            iflink = *((const uint32_t*)RTA_DATA(attr));
+            break;
+        case IFLA_OPERSTATE:
+            operstate = *((const uint8_t*)RTA_DATA(attr));
+            break;
+        case IFLA_LINKINFO:
+            for_each_rtattr((const rtattr*)RTA_DATA(attr), RTA_PAYLOAD(attr), [&kind](const rtattr* info) {
+                if (info->rta_type == IFLA_INFO_KIND) {
+                    kind = (const char*)RTA_DATA(info);
+                }
+            });
+            break;
+        case ifla_parent_dev_name:
+            has_parent = true;
+            break;
+        default:
+            break;
+        }
+    });
+    if (name.empty()) {
+        return false;
+    }
+
+    card.ifindex = static_cast<uint32_t>(ifi->ifi_index);
+    card.is_down = (operstate == if_oper_down);
+    card.is_physics = is_physics_link(name, ifi->ifi_flags, !kind.empty(), has_parent);
+    std::error_code ig;
+    if (kind == "veth") { //veth reports a fixed speed
+        card.receive_speed = 1000 * 10;
+    }
+    else {
+        card.receive_speed = get_network_card_speed(name, ig);
+    }
+    card.transmit_speed = card.receive_speed;
+    card.real_name = name;
+    card.friend_name = name;
+    card.desc = std::move(name);
+    return true;
+}
+
+//add or remove the address of an RTM_NEWADDR/RTM_DELADDR message, false when nothing changed
+inline bool apply_card_address(networkcard& card, const ifaddrmsg* ifa, const rtattr* attrs, uint32_t len, bool add) {
+    char buf[INET6_ADDRSTRLEN];
+    auto address = format_card_address(ifa, attrs, len, buf);
+    if (address.empty() || (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+        return false;
+    }
+    auto& set = (ifa->ifa_family == AF_INET) ? card.ipv4 : card.ipv6;
+    if (add) {
+        return set.emplace(address).second;
+    }
+    return set.erase(std::string(address)) != 0;
+}
+
+//one RTM_GETLINK and one RTM_GETADDR dump build every card, sysfs is only read for the speed
+//of cards other than lo and veth, which netlink does not report.
+inline network_card_t get_network_card_netlink(netlink_socket& socket, bool& has_veth_pair_card, std::error_code& ec) {
+    network_card_t cards;
+    std::unordered_map<uint32_t, networkcard*> indexes;
+    has_veth_pair_card = false;
+    dump_link(socket, [&](const ifinfomsg* ifi, const rtattr* attrs, uint32_t len) {
+        networkcard card{};
+        uint32_t iflink = 0;
+        if (!parse_network_card(ifi, attrs, len, card, iflink)) {
+            return;
+        }
+        has_veth_pair_card = has_veth_pair_card || (iflink != 0 && iflink != card.ifindex);
+        auto name = card.real_name;
+        auto it = cards.insert_or_assign(std::move(name), std::move(card)).first;
+        indexes[it->second.ifindex] = &it->second;
+    }, ec);
+    if (ec) {
+        return {};
+    }
+
+    dump_addr(socket, AF_UNSPEC, [&indexes](const ifaddrmsg* ifa, const rtattr* attrs, uint32_t len) {
+        if (auto it = indexes.find(ifa->ifa_index); it != indexes.end()) {
+            apply_card_address(*it->second, ifa, attrs, len, true);
+        }
+    }, ec);
+    if (ec) {
+        return {};
+    }
+    return cards;
+}
+
+inline network_card_t get_network_card_netlink(std::error_code& ec) {
+    thread_local netlink_socket socket;
+    bool has_veth_pair_card = false;
+    auto cards = get_network_card_netlink(socket, has_veth_pair_card, ec);
+    if (ec || !has_veth_pair_card) {
+        return cards;
+    }
+    auto ips = get_container_ip(ec);
+    for (auto& [name, info] : cards) {
+        if (auto it = ips.find(info.ifindex);
+            it != ips.end() && info.ipv4.empty() && info.ipv6.empty()) { //this is a container card
+            auto&& [ipv4, ipv6] = it->second;
+            info.ipv4 = std::move(ipv4);
+            info.ipv6 = std::move(ipv6);
+        }
+    }
+    return cards;
+}
+
+//falls back to getifaddrs and sysfs when netlink is not available
+inline network_card_t get_network_card(std::error_code& ec) {
+    ec.clear();
+    auto cards = get_network_card_netlink(ec);
+    if (ec) {
+        return get_network_card_ifaddrs(ec);
+    }
+    return cards;
+}
+
+//keep network_card_t up to date from rtnetlink link and address notifications after one full dump.
+//readers take an immutable view, a change publishes a new view with a higher version, so nothing
+//is read from the kernel while the topology is stable. addresses of cards in other net namespaces,
+//which get_network_card finds for veth peers, are not tracked.
+class network_topology {
+private:
+    netlink_socket events_{ NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR };
+    netlink_socket dump_;
+    std::function<void(const network_topology_event&)> callback_;
+    std::shared_ptr<const network_card_t> view_ = std::make_shared<const network_card_t>();
+    std::unordered_map<uint32_t, std::string> names_; //ifindex to key of view_, used by the polling thread
+    uint64_t version_ = 0;
+    mutable std::mutex mutex_;
+
+public:
+    network_topology() = default;
+    network_topology(const network_topology&) = delete;
+    network_topology& operator=(const network_topology&) = delete;
+
+    //called on the thread calling poll, after the view holding the change is published
+    void set_callback(std::function<void(const network_topology_event&)> callback) {
+        callback_ = std::move(callback);
+    }
+
+    //subscribe and take the initial dump. events racing with the dump are applied by the next poll.
+    void start(std::error_code& ec) {
+        events_.open(ec);
+        if (ec) {
+            return;
+        }
+        resync(ec);
+    }
+
+    //readable when notifications are pending, for an external epoll
+    int native_handle() const { return events_.native_handle(); }
+
+    //wait up to timeout for notifications and apply them, return the number of changes.
+    //a lost notification (socket buffer overflow) triggers a full dump.
+    size_t poll(std::chrono::milliseconds timeout, std::error_code& ec) {
+        ec.clear();
+        pollfd pfd{ events_.native_handle(), POLLIN, 0 };
+        auto n = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+        if (n < 0) {
+            if (errno != EINTR) {
+                ec = std::error_code(errno, std::system_category());
+            }
+            return 0;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        return process(ec);
+    }
+
+    //apply pending notifications without blocking, return the number of changes.
+    //the view is copied once for a batch with a change and not at all for messages changing nothing.
+    size_t process(std::error_code& ec) {
+        std::vector<network_topology_event> events;
+        auto current = view();
+        std::shared_ptr<network_card_t> next;
+        auto cards = [&]() -> const network_card_t& {
+            return next ? *next : *current;
+        };
+        auto edit = [&]() -> network_card_t& {
+            if (!next) {
+                next = std::make_shared<network_card_t>(*current);
+            }
+            return *next;
+        };
+
+        events_.receive([&](const nlmsghdr* nlh) {
+            switch (nlh->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+                apply_link(cards, edit, nlh, events);
+                break;
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+                apply_address(cards, edit, nlh, events);
+                break;
+            default:
+                break;
+            }
+        }, ec);
+        if (ec == std::errc::no_buffer_space) {
+            auto before = view();
+            resync(ec);
+            return ec ? 0 : diff(*before, *view());
+        }
+        if (!next) {
+            return 0;
+        }
+        publish(std::move(next));
+        for (const auto& event : events) {
+            if (callback_) {
+                callback_(event);
+            }
+        }
+        return events.size();
+    }
+
+    std::shared_ptr<const network_card_t> view() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return view_;
+    }
+
+    //increases each time a new view is published
+    uint64_t version() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return version_;
+    }
+
+private:
+    void publish(std::shared_ptr<const network_card_t> next) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        view_ = std::move(next);
+        version_++;
+    }
+
+    void resync(std::error_code& ec) {
+        bool has_veth_pair_card = false;
+        auto cards = get_network_card_netlink(dump_, has_veth_pair_card, ec);
+        if (ec) {
+            return;
+        }
+        names_.clear();
+        for (const auto& [name, card] : cards) {
+            names_[card.ifindex] = name;
+        }
+        publish(std::make_shared<const network_card_t>(std::move(cards)));
+    }
+
+    //a card of the view by ifindex, nullptr when unknown
+    template<typename Cards>
+    const networkcard* find_card(Cards& cards, uint32_t ifindex) const {
+        auto name = names_.find(ifindex);
+        if (name == names_.end()) {
+            return nullptr;
+        }
+        auto it = cards().find(name->second);
+        return it == cards().end() ? nullptr : &it->second;
+    }
+
+    static bool same_link(const networkcard& l, const networkcard& r) {
+        return l.real_name == r.real_name && l.is_down == r.is_down && l.is_physics == r.is_physics
+            && l.friend_name == r.friend_name && l.desc == r.desc
+            && l.receive_speed == r.receive_speed && l.transmit_speed == r.transmit_speed;
+    }
+
+    //report the differences of a full dump as events
+    size_t diff(const network_card_t& before, const network_card_t& after) {
+        std::vector<network_topology_event> events;
+        for (const auto& [name, card] : before) {
+            if (after.find(name) == after.end()) {
+                events.push_back({ network_topology_event::card_removed, card.ifindex, name, {} });
+            }
+        }
+        for (const auto& [name, card] : after) {
+            auto it = before.find(name);
+            if (it == before.end()) {
+                events.push_back({ network_topology_event::card_added, card.ifindex, name, {} });
+            }
+            else if (it->second.is_down != card.is_down || it->second.ipv4 != card.ipv4 || it->second.ipv6 != card.ipv6) {
+                events.push_back({ network_topology_event::card_changed, card.ifindex, name, {} });
+            }
+        }
+        for (const auto& event : events) {
+            if (callback_) {
+                callback_(event);
+            }
+        }
+        return events.size();
+    }
+
+    template<typename Cards, typename Edit>
+    void apply_link(Cards& cards, Edit& edit, const nlmsghdr* nlh, std::vector<network_topology_event>& events) {
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+            return;
+        }
+        auto ifi = (const struct ifinfomsg*)NLMSG_DATA(nlh);
+        auto attrs = (const rtattr*)IFLA_RTA(ifi);
+        auto len = static_cast<uint32_t>(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+        auto ifindex = static_cast<uint32_t>(ifi->ifi_index);
+        auto old = find_card(cards, ifindex);
+
+        if (nlh->nlmsg_type == RTM_DELLINK) {
+            if (old != nullptr) {
+                auto name = old->real_name;
+                events.push_back({ network_topology_event::card_removed, ifindex, name, {} });
+                edit().erase(name);
+                names_.erase(ifindex);
+            }
+            return;
+        }
+
+        networkcard card{};
+        uint32_t iflink = 0;
+        if (!parse_network_card(ifi, attrs, len, card, iflink)) {
+            return;
+        }
+        auto type = network_topology_event::card_added;
+        if (old != nullptr) {
+            if (same_link(*old, card)) { //e.g. a statistics only notification
+                return;
+            }
+            card.ipv4 = old->ipv4; //a link message carries no addresses, keep the known ones
+            card.ipv6 = old->ipv6;
+            type = network_topology_event::card_changed;
+            edit().erase(names_[ifindex]); //the card may have been renamed
+        }
+        names_[ifindex] = card.real_name;
+        events.push_back({ type, ifindex, card.real_name, {} });
+        auto name = card.real_name;
+        edit().insert_or_assign(std::move(name), std::move(card));
+    }
+
+    template<typename Cards, typename Edit>
+    void apply_address(Cards& cards, Edit& edit, const nlmsghdr* nlh, std::vector<network_topology_event>& events) {
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+            return;
+        }
+        auto ifa = (const struct ifaddrmsg*)NLMSG_DATA(nlh);
+        auto attrs = (const rtattr*)IFA_RTA(ifa);
+        auto len = static_cast<uint32_t>(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
+        auto old = find_card(cards, ifa->ifa_index);
+        if (old == nullptr || (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+            return;
+        }
+        char buf[INET6_ADDRSTRLEN];
+        auto address = format_card_address(ifa, attrs, len, buf); //empty for skipped addresses
+        if (address.empty()) {
+            return;
+        }
+        bool add = nlh->nlmsg_type == RTM_NEWADDR;
+        const auto& set = (ifa->ifa_family == AF_INET) ? old->ipv4 : old->ipv6;
+        if ((set.find(std::string(address)) != set.end()) == add) {
+            return;
+        }
+        auto name = old->real_name;
+        apply_card_address(edit()[name], ifa, attrs, len, add);
+        events.push_back({ add ? network_topology_event::address_added : network_topology_event::address_removed,
+            ifa->ifa_index, std::move(name), std::string(address) });
+    }
+};
+
 template<typename C>
 inline card_flow get_network_card_flow(C&& c, std::error_code& ec)
 {
     ec.clear();
-    FILE* fp = fopen("/proc/net/dev", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return {};
-    }
-    char buf[1024] = { 0 };
-    char interface[128]{};
+    thread_local proc_reader reader("/proc/net/dev");
+    char buf[1024];
+    std::string name; //card name is shorter than IFNAMSIZ, so no heap allocation
     card_flow flow;
-    while (fgets(buf, sizeof(buf), fp) != nullptr) {
-        uint64_t receive_bytes = 0;
-        uint64_t receive_packets, receive_errs, receive_drop,
-            receive_fifo, receive_frame, receive_compressed, receive_multicast;
-
-        uint64_t transmit_bytes = 0;
-        uint64_t transmit_packets, transmit_errs, transmit_drop,
-            transmit_fifo, transmit_colls, transmit_carrier, transmit_compressed;
-
-        sscanf(buf, "%[^:]: %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-            interface,
-            &receive_bytes, &receive_packets, &receive_errs, &receive_drop,
-            &receive_fifo, &receive_frame, &receive_compressed, &receive_multicast,
-            &transmit_bytes, &transmit_packets, &transmit_errs, &transmit_drop,
-            &transmit_fifo, &transmit_colls, &transmit_carrier, &transmit_compressed);
-
-        size_t i = 0;
-        while (interface[i] == ' ') {
-            i++;
-            continue;
+    reader.for_each_line(buf, [&c, &name, &flow](std::string_view line) {
+        auto pos = line.find(':');
+        if (pos == std::string_view::npos) { //header
+            return true;
         }
-        std::string name{ interface + i, strlen(interface + i) };
+        auto interface = line.substr(0, pos);
+        line.remove_prefix(pos + 1);
+        skip_space(interface);
+        name = interface;
 
         auto it = c.find(name);
-        if (it != c.end()) {
-            flow.emplace(std::move(name), std::pair{ receive_bytes, transmit_bytes });
+        if (it == c.end()) {
+            return true;
         }
-        memset(buf, 0, sizeof(buf));
-        memset(interface, 0, sizeof(interface));
-    }
-    fclose(fp);
+        //receive: bytes packets errs drop fifo frame compressed multicast
+        uint64_t receive_bytes = parse_uint(line);
+        for (int i = 0; i < 7; i++) {
+            parse_uint(line);
+        }
+        //transmit: bytes packets errs drop fifo colls carrier compressed
+        uint64_t transmit_bytes = parse_uint(line);
+        flow.emplace(name, std::pair{ receive_bytes, transmit_bytes });
+        return true;
+    }, ec);
     return flow;
 }
 
@@ -652,54 +1912,1128 @@ inline disk_info get_disk_info(std::string_view name, std::error_code& ec) {
     return info;
 }
 
-inline auto tcp_used_port(std::error_code& ec) {
+inline void get_network_card_counter_proc(std::vector<card_counter>& counters, std::error_code& ec) {
     ec.clear();
-    std::unordered_set<uint16_t> tcp_ports;
-
-    auto parse_port = [](std::string_view buf_view, std::unordered_set<uint16_t>& ports) {
-        auto pos = buf_view.find(':');
-        if (pos == std::string_view::npos) {
+    counters.clear();
+    thread_local proc_reader reader("/proc/net/dev");
+    char buf[4096];
+    reader.for_each_line(buf, [&counters](std::string_view line) {
+        auto pos = line.find(':');
+        if (pos == std::string_view::npos) { //header
+            return true;
+        }
+        auto interface = line.substr(0, pos);
+        line.remove_prefix(pos + 1);
+        skip_space(interface);
+
+        card_counter counter{};
+        memcpy(counter.name, interface.data(), std::min(interface.size(), sizeof(counter.name) - 1));
+        counter.receive_bytes = parse_uint(line);
+        counter.receive_packets = parse_uint(line);
+        counter.receive_errs = parse_uint(line);
+        counter.receive_drop = parse_uint(line);
+        for (int i = 0; i < 4; i++) { //fifo frame compressed multicast
+            parse_uint(line);
+        }
+        counter.transmit_bytes = parse_uint(line);
+        counter.transmit_packets = parse_uint(line);
+        counter.transmit_errs = parse_uint(line);
+        counter.transmit_drop = parse_uint(line);
+        counter.is_physics = is_physics_link(counter.name, 0, false, false);
+        counters.push_back(counter);
+        return true;
+    }, ec);
+}
+
+inline void copy_link_stats64(const rtattr* attr, card_counter& counter) {
+    rtnl_link_stats64 stats; //attribute payload is only 4 byte aligned
+    memcpy(&stats, RTA_DATA(attr), sizeof(stats));
+    counter.receive_bytes = stats.rx_bytes;
+    counter.receive_packets = stats.rx_packets;
+    counter.receive_errs = stats.rx_errors;
+    counter.receive_drop = stats.rx_dropped;
+    counter.transmit_bytes = stats.tx_bytes;
+    counter.transmit_packets = stats.tx_packets;
+    counter.transmit_errs = stats.tx_errors;
+    counter.transmit_drop = stats.tx_dropped;
+}
+
+//name, ifindex and is_physics of counter from an RTM_NEWLINK message, with the stats when it carries IFLA_STATS64
+inline void parse_link_counter(const ifinfomsg* ifi, const rtattr* attrs, uint32_t len, card_counter& counter) {
+    constexpr unsigned short ifla_parent_dev_name = 56; //IFLA_PARENT_DEV_NAME, linux 5.17
+    bool has_kind = false;
+    bool has_parent = false;
+    counter.ifindex = static_cast<uint32_t>(ifi->ifi_index);
+    for_each_rtattr(attrs, len, [&](const rtattr* attr) {
+        switch (attr->rta_type) {
+        case IFLA_IFNAME: {
+            auto name = (const char*)RTA_DATA(attr);
+            auto size = strnlen(name, std::min<size_t>(RTA_PAYLOAD(attr), sizeof(counter.name) - 1));
+            memcpy(counter.name, name, size);
+            break;
+        }
+        case IFLA_STATS64:
+            if (RTA_PAYLOAD(attr) >= sizeof(rtnl_link_stats64)) {
+                copy_link_stats64(attr, counter);
+            }
+            break;
+        case IFLA_LINKINFO:
+            for_each_rtattr((const rtattr*)RTA_DATA(attr), RTA_PAYLOAD(attr), [&has_kind](const rtattr* info) {
+                has_kind = has_kind || info->rta_type == IFLA_INFO_KIND;
+            });
+            break;
+        case ifla_parent_dev_name:
+            has_parent = true;
+            break;
+        default:
+            break;
+        }
+    });
+    counter.is_physics = is_physics_link(counter.name, ifi->ifi_flags, has_kind, has_parent);
+}
+
+//64 bit counters of every card from one RTM_GETLINK dump with IFLA_STATS64
+inline void get_network_card_counter_link(
+    netlink_socket& socket, std::vector<card_counter>& counters, std::error_code& ec)
+{
+    counters.clear();
+    dump_link(socket, [&counters](const ifinfomsg* ifi, const rtattr* attrs, uint32_t len) {
+        card_counter counter{};
+        parse_link_counter(ifi, attrs, len, counter);
+        counters.push_back(counter);
+    }, ec);
+}
+
+//64 bit counters of every card. an RTM_GETSTATS dump carries only ifindex and IFLA_STATS_LINK_64,
+//several times cheaper than RTM_GETLINK which serializes every link attribute. names and is_physics
+//come from an RTM_GETLINK dump cached per thread and refreshed when an unknown ifindex shows up,
+//so a renamed card keeps its old name until another card is added.
+inline void get_network_card_counter_netlink(std::vector<card_counter>& counters, std::error_code& ec) {
+    counters.clear();
+    thread_local netlink_socket socket;
+    thread_local std::unordered_map<uint32_t, card_counter> names;
+    thread_local bool has_getstats = true;
+    if (!has_getstats) { //before linux 4.7
+        get_network_card_counter_link(socket, counters, ec);
+        return;
+    }
+
+    struct {
+        struct nlmsghdr hdr;
+        struct if_stats_msg ifsm;
+    } req{};
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg));
+    req.hdr.nlmsg_type = RTM_GETSTATS;
+    req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+    bool unknown = false;
+    socket.dump(&req.hdr, [&](const nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWSTATS || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct if_stats_msg))) {
+            return true;
+        }
+        auto ifsm = (const struct if_stats_msg*)NLMSG_DATA(nlh);
+        card_counter counter{};
+        counter.ifindex = ifsm->ifindex;
+        auto attrs = (const rtattr*)((const char*)ifsm + NLMSG_ALIGN(sizeof(*ifsm)));
+        for_each_rtattr(attrs, static_cast<uint32_t>(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm))),
+            [&counter](const rtattr* attr) {
+            if (attr->rta_type == IFLA_STATS_LINK_64 && RTA_PAYLOAD(attr) >= sizeof(rtnl_link_stats64)) {
+                copy_link_stats64(attr, counter);
+            }
+        });
+        unknown = unknown || names.find(counter.ifindex) == names.end();
+        counters.push_back(counter);
+        return true;
+    }, ec);
+    if (ec == std::errc::invalid_argument || ec == std::errc::operation_not_supported) {
+        has_getstats = false;
+        get_network_card_counter_link(socket, counters, ec);
+        return;
+    }
+    if (ec) {
+        return;
+    }
+
+    if (unknown) {
+        names.clear();
+        dump_link(socket, [](const ifinfomsg* ifi, const rtattr* attrs, uint32_t len) {
+            card_counter link{};
+            parse_link_counter(ifi, attrs, len, link);
+            if (link.name[0] != '\0') {
+                names[link.ifindex] = link;
+            }
+        }, ec);
+        if (ec) {
             return;
         }
-        buf_view = buf_view.substr(pos + 1);
-        pos = buf_view.find(':');
-        if (pos == std::string_view::npos) {
+    }
+    for (auto& counter : counters) {
+        if (auto it = names.find(counter.ifindex); it != names.end()) {
+            memcpy(counter.name, it->second.name, sizeof(counter.name));
+            counter.is_physics = it->second.is_physics;
+        }
+    }
+}
+
+//fill counters in place, a reused vector keeps its capacity so sampling does not allocate.
+//falls back to /proc/net/dev, without ifindex, when netlink is not available.
+inline void get_network_card_counter(std::vector<card_counter>& counters, std::error_code& ec) {
+    get_network_card_counter_netlink(counters, ec);
+    if (ec) {
+        get_network_card_counter_proc(counters, ec);
+    }
+}
+
+//delta of a counter which may be 32 bit in some drivers. a value below the previous one is a wrap
+//when both fit in 32 bit and the previous one was in the upper half, otherwise a reset.
+inline bool card_counter_delta(uint64_t pre, uint64_t now, uint64_t& delta) {
+    if (now >= pre) {
+        delta = now - pre;
+        return true;
+    }
+    constexpr uint64_t wrap = 1ull << 32;
+    if (pre < wrap && pre >= wrap / 2) {
+        delta = wrap - pre + now;
+        return true;
+    }
+    delta = 0;
+    return false;
+}
+
+//rates of one card over seconds, rate.reset is set when any counter was reset
+inline void calculate_card_rate(const card_counter& pre, const card_counter& now, double seconds, card_rate& rate) {
+    rate = card_rate{};
+    memcpy(rate.name, now.name, sizeof(rate.name));
+    rate.ifindex = now.ifindex;
+    if (seconds <= 0) {
+        return;
+    }
+    const uint64_t card_counter::* fields[] = {
+        &card_counter::receive_bytes, &card_counter::receive_packets,
+        &card_counter::receive_errs, &card_counter::receive_drop,
+        &card_counter::transmit_bytes, &card_counter::transmit_packets,
+        &card_counter::transmit_errs, &card_counter::transmit_drop,
+    };
+    double card_rate::* rates[] = {
+        &card_rate::receive_bytes, &card_rate::receive_packets,
+        &card_rate::receive_errs, &card_rate::receive_drop,
+        &card_rate::transmit_bytes, &card_rate::transmit_packets,
+        &card_rate::transmit_errs, &card_rate::transmit_drop,
+    };
+    uint64_t deltas[std::size(fields)];
+    for (size_t i = 0; i < std::size(fields); i++) {
+        if (!card_counter_delta(pre.*fields[i], now.*fields[i], deltas[i])) {
+            rate.reset = true;
             return;
         }
+    }
+    for (size_t i = 0; i < std::size(fields); i++) {
+        rate.*rates[i] = (double)deltas[i] / seconds;
+    }
+}
+
+//turn timestamped counters of every card into per second rates. cards are matched by name, a card
+//recreated with another ifindex counts as a reset. with a non zero time constant it also keeps an
+//ewma per card, weighted by the real interval so irregular sampling does not skew it.
+class card_rate_calculator {
+private:
+    struct card_state {
+        card_counter counter;
+        card_rate ewma;
+        bool has_ewma = false;
+        bool seen = false;
+    };
 
-        auto port_str = std::string(buf_view.substr(pos + 1, 4));
-        char* end_ptr = nullptr;
-        auto port = static_cast<uint16_t>(std::strtoull(port_str.data(), &end_ptr, 16));
-        if (end_ptr != port_str.data()) {
-            ports.emplace(port);
+    std::chrono::nanoseconds time_constant_;
+    uint64_t timestamp_ns_ = 0;
+    std::unordered_map<std::string, card_state> cards_;
+
+public:
+    explicit card_rate_calculator(std::chrono::nanoseconds ewma_time_constant = std::chrono::nanoseconds::zero())
+        : time_constant_(ewma_time_constant) {}
+
+    //timestamp_ns is CLOCK_MONOTONIC when the counters were read, e.g. host_snapshot::timestamp_ns.
+    //rates holds cards present in this and the previous update, cards which have gone are forgotten.
+    void update(uint64_t timestamp_ns, const std::vector<card_counter>& counters, std::vector<card_rate>& rates) {
+        rates.clear();
+        bool first = timestamp_ns_ == 0;
+        double seconds = (!first && timestamp_ns > timestamp_ns_) ? (double)(timestamp_ns - timestamp_ns_) / 1e9 : 0;
+        double alpha = 1;
+        if (time_constant_.count() > 0) {
+            alpha = 1 - exp(-seconds * 1e9 / (double)time_constant_.count());
+        }
+
+        for (const auto& counter : counters) {
+            auto [it, inserted] = cards_.try_emplace(counter.name);
+            auto& state = it->second;
+            state.seen = true;
+            if (!inserted && seconds > 0) {
+                card_rate rate;
+                calculate_card_rate(state.counter, counter, seconds, rate);
+                if (state.counter.ifindex != counter.ifindex) {
+                    rate = card_rate{};
+                    memcpy(rate.name, counter.name, sizeof(rate.name));
+                    rate.ifindex = counter.ifindex;
+                    rate.reset = true;
+                }
+                if (time_constant_.count() > 0) {
+                    update_ewma(state, rate, alpha);
+                }
+                rates.push_back(rate);
+            }
+            state.counter = counter;
+        }
+
+        for (auto it = cards_.begin(); it != cards_.end();) {
+            if (!it->second.seen) {
+                it = cards_.erase(it);
+                continue;
+            }
+            it->second.seen = false;
+            ++it;
+        }
+        if (first || timestamp_ns > timestamp_ns_) {
+            timestamp_ns_ = timestamp_ns;
+        }
+    }
+
+    //smoothed rates of a card, false before its first rate or without a time constant
+    bool ewma(const std::string& name, card_rate& rate) const {
+        auto it = cards_.find(name);
+        if (it == cards_.end() || !it->second.has_ewma) {
+            return false;
+        }
+        rate = it->second.ewma;
+        return true;
+    }
+
+    void clear() {
+        cards_.clear();
+        timestamp_ns_ = 0;
+    }
+
+private:
+    static void update_ewma(card_state& state, const card_rate& rate, double alpha) {
+        if (rate.reset) { //a reset interval carries no rate, keep the average
+            return;
+        }
+        if (!state.has_ewma) {
+            state.ewma = rate;
+            state.has_ewma = true;
+            return;
+        }
+        double card_rate::* rates[] = {
+            &card_rate::receive_bytes, &card_rate::receive_packets,
+            &card_rate::receive_errs, &card_rate::receive_drop,
+            &card_rate::transmit_bytes, &card_rate::transmit_packets,
+            &card_rate::transmit_errs, &card_rate::transmit_drop,
+        };
+        for (auto field : rates) {
+            state.ewma.*field += alpha * (rate.*field - state.ewma.*field);
+        }
+        state.ewma.ifindex = rate.ifindex;
+    }
+};
+
+inline uint64_t monotonic_now_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+//collect every collector in mask in one pass. syscalls per call are bounded:
+//one clock_gettime, one pread per 4KB chunk of /proc/stat, /proc/meminfo and /proc/net/dev,
+//one statfs per disk and one pread per pressure file. files stay open between calls.
+//ec holds the first error, snapshot.collected tells which collectors succeeded.
+inline void get_host_snapshot(host_snapshot& snapshot, uint32_t mask, std::error_code& ec) {
+    ec.clear();
+    snapshot.collected = 0;
+    snapshot.timestamp_ns = monotonic_now_ns();
+
+    std::error_code collect_ec;
+    auto done = [&](uint32_t item) {
+        if (!collect_ec) {
+            snapshot.collected |= item;
+        }
+        else if (!ec) {
+            ec = collect_ec;
         }
     };
-    
-    FILE* fp = fopen("/proc/net/tcp", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return tcp_ports;
+
+    if (mask & collect_cpu_core) {
+        get_cpu_core_occupy(snapshot.cpu_core, collect_ec);
+        snapshot.cpu = snapshot.cpu_core.total;
+        done(collect_cpu_core | (mask & collect_cpu));
     }
-    char buf[1024]{};
-    while (fgets(buf, sizeof(buf), fp)) {
-        std::string_view buf_view = buf;
-        parse_port(buf_view, tcp_ports);
+    else if (mask & collect_cpu) {
+        snapshot.cpu = get_cpu_occupy(collect_ec);
+        done(collect_cpu);
     }
-    fclose(fp);
+    if (mask & collect_memory) {
+        snapshot.memory = get_memory_info(collect_ec);
+        done(collect_memory);
+    }
+    if (mask & collect_network) {
+        get_network_card_counter(snapshot.network, collect_ec);
+        done(collect_network);
+    }
+    if (mask & collect_disk) {
+        std::error_code disk_ec;
+        collect_ec.clear();
+        for (auto& [path, info] : snapshot.disks) {
+            info = get_disk_info(path, disk_ec);
+            if (disk_ec && !collect_ec) {
+                collect_ec = disk_ec;
+            }
+        }
+        done(collect_disk);
+    }
+    if (mask & collect_pressure) {
+        std::error_code cpu_ec, memory_ec, io_ec;
+        snapshot.cpu_pressure = get_pressure_info(pressure_resource::cpu, cpu_ec);
+        snapshot.memory_pressure = get_pressure_info(pressure_resource::memory, memory_ec);
+        snapshot.io_pressure = get_pressure_info(pressure_resource::io, io_ec);
+        collect_ec = cpu_ec ? cpu_ec : (memory_ec ? memory_ec : io_ec);
+        done(collect_pressure);
+    }
+}
 
-    auto fp6 = fopen("/proc/net/tcp6", "r");
-    if (fp6 == nullptr) {
-        ec = std::error_code(errno, std::system_category());
+inline host_snapshot get_host_snapshot(uint32_t mask, std::error_code& ec) {
+    host_snapshot snapshot{};
+    get_host_snapshot(snapshot, mask, ec);
+    return snapshot;
+}
+
+//set the local port of sockets in /proc/net/<file> whose state is in states, for kernels without sock_diag
+inline void get_port_bitmap_proc(const char* file, const char* file6, port_bitmap& ports, uint32_t states, std::error_code& ec) {
+    //  sl  local_address rem_address   st ...
+    //   0: 0100007F:0277 00000000:0000 0A ...
+    auto parse_port = [&ports, states](std::string_view line) {
+        next_token(line); //sl
+        auto local = next_token(line);
+        next_token(line); //rem_address
+        auto state = static_cast<uint32_t>(parse_hex(line));
+        auto pos = local.rfind(':');
+        if (pos == std::string_view::npos || state > 31 || (states & (1u << state)) == 0) {
+            return true;
+        }
+        auto port_str = local.substr(pos + 1);
+        auto len = port_str.size();
+        auto port = static_cast<uint16_t>(parse_hex(port_str));
+        if (port_str.size() != len) {
+            ports.set(port);
+        }
+        return true;
+    };
+
+    proc_reader reader(file);
+    proc_reader reader6(file6);
+    char buf[4096];
+    reader.for_each_line(buf, parse_port, ec);
+    if (ec) {
+        return;
+    }
+    std::error_code ig; //no ipv6
+    reader6.for_each_line(buf, parse_port, ig);
+}
+
+//set the local port of every socket of protocol (IPPROTO_TCP or IPPROTO_UDP) whose state is in states.
+//the kernel filters the states and sends only fixed size inet_diag_msg, no text is formatted or parsed.
+inline void get_port_bitmap(port_bitmap& ports, uint8_t protocol, uint32_t states, std::error_code& ec) {
+    ec.clear();
+    ports.clear();
+    thread_local netlink_socket socket(NETLINK_SOCK_DIAG);
+    for (uint8_t family : { AF_INET, AF_INET6 }) {
+        struct {
+            struct nlmsghdr hdr;
+            struct inet_diag_req_v2 req;
+        } req{};
+        req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct inet_diag_req_v2));
+        req.hdr.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        req.req.sdiag_family = family;
+        req.req.sdiag_protocol = protocol;
+        req.req.idiag_states = states;
+        socket.dump(&req.hdr, [&ports](const nlmsghdr* nlh) {
+            if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct inet_diag_msg))) {
+                return true;
+            }
+            auto msg = (const struct inet_diag_msg*)NLMSG_DATA(nlh);
+            ports.set(ntohs(msg->id.idiag_sport));
+            return true;
+        }, ec);
+        if (ec) {
+            break;
+        }
+    }
+    if (!ec) {
+        return;
+    }
+
+    ports.clear(); //sock_diag or inet_diag is not available
+    if (protocol == IPPROTO_UDP) {
+        get_port_bitmap_proc("/proc/net/udp", "/proc/net/udp6", ports, states, ec);
+    }
+    else {
+        get_port_bitmap_proc("/proc/net/tcp", "/proc/net/tcp6", ports, states, ec);
+    }
+}
+
+inline void get_tcp_port_bitmap(port_bitmap& ports, uint32_t states, std::error_code& ec) {
+    get_port_bitmap(ports, IPPROTO_TCP, states, ec);
+}
+
+inline auto tcp_used_port(std::error_code& ec) {
+    std::unordered_set<uint16_t> tcp_ports;
+    auto ports = std::make_unique<port_bitmap>();
+    get_tcp_port_bitmap(*ports, tcp_all_states, ec);
+    if (ec) {
         return tcp_ports;
     }
-    while (fgets(buf, sizeof(buf), fp6)) {
-        std::string_view buf_view = buf;
-        parse_port(buf_view, tcp_ports);
+    for (size_t i = 0; i < std::size(ports->words); i++) {
+        for (auto word = ports->words[i]; word != 0; word &= word - 1) {
+            tcp_ports.emplace(static_cast<uint16_t>(i * 64 + static_cast<size_t>(__builtin_ctzll(word))));
+        }
     }
-    fclose(fp6);
     return tcp_ports;
 }
 
+inline void copy_socket_entry(const struct inet_diag_msg* msg, uint8_t protocol, socket_entry& entry) {
+    entry.family = msg->idiag_family;
+    entry.protocol = protocol;
+    entry.state = msg->idiag_state;
+    entry.local_port = ntohs(msg->id.idiag_sport);
+    entry.remote_port = ntohs(msg->id.idiag_dport);
+    entry.uid = msg->idiag_uid;
+    entry.inode = msg->idiag_inode;
+    memcpy(entry.local_address, msg->id.idiag_src, sizeof(entry.local_address));
+    memcpy(entry.remote_address, msg->id.idiag_dst, sizeof(entry.remote_address));
+}
+
+//append the sockets of protocol in states of both families, states is tcp_state_mask values
+inline void get_socket_entry(std::vector<socket_entry>& entries, uint8_t protocol, uint32_t states, std::error_code& ec) {
+    ec.clear();
+    thread_local netlink_socket socket(NETLINK_SOCK_DIAG);
+    for (uint8_t family : { AF_INET, AF_INET6 }) {
+        struct {
+            struct nlmsghdr hdr;
+            struct inet_diag_req_v2 req;
+        } req{};
+        req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct inet_diag_req_v2));
+        req.hdr.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        req.req.sdiag_family = family;
+        req.req.sdiag_protocol = protocol;
+        req.req.idiag_states = states;
+        socket.dump(&req.hdr, [&entries, protocol](const nlmsghdr* nlh) {
+            if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct inet_diag_msg))) {
+                return true;
+            }
+            copy_socket_entry((const struct inet_diag_msg*)NLMSG_DATA(nlh), protocol, entries.emplace_back());
+            return true;
+        }, ec);
+        if (ec) {
+            return;
+        }
+    }
+}
+
+//map socket inodes to the pids holding them, built from readlinkat of every /proc/<pid>/fd entry.
+//a refresh rescans only new pids and pids whose fd count changed, the st_size of /proc/<pid>/fd
+//since linux 6.2. older kernels report 0 there and every pid is rescanned. a socket shared by
+//several processes, e.g. across fork, is attributed to one of them. fd directories of other
+//users need CAP_SYS_PTRACE and are skipped without it.
+class socket_owner_map {
+private:
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    struct process_sockets {
+        int64_t fd_count = -1;
+        uint64_t generation = 0;
+        std::vector<uint64_t> inodes;
+    };
+
+    static constexpr size_t buf_size = 32 * 1024;
+    int proc_fd_ = -1;
+    uint64_t generation_ = 0;
+    std::unique_ptr<char[]> buf_ = std::make_unique<char[]>(buf_size);
+    std::unique_ptr<char[]> fd_buf_ = std::make_unique<char[]>(buf_size);
+    std::unordered_map<uint32_t, process_sockets> processes_;
+    std::unordered_map<uint64_t, uint32_t> index_;
+    std::unordered_set<uint64_t> unresolved_; //no owner after the last full refresh
+
+public:
+    socket_owner_map() = default;
+    ~socket_owner_map() {
+        if (proc_fd_ != -1) {
+            close(proc_fd_);
+        }
+    }
+
+    socket_owner_map(const socket_owner_map&) = delete;
+    socket_owner_map& operator=(const socket_owner_map&) = delete;
+
+    //incremental unless full, which rescans every pid, e.g. after an fd was closed and another opened
+    void refresh(bool full, std::error_code& ec) {
+        ec.clear();
+        if (proc_fd_ == -1) {
+            proc_fd_ = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (proc_fd_ == -1) {
+                ec = std::error_code(errno, std::system_category());
+                return;
+            }
+        }
+        generation_++;
+        lseek(proc_fd_, 0, SEEK_SET);
+        while (true) {
+            auto len = syscall(SYS_getdents64, proc_fd_, buf_.get(), buf_size);
+            if (len < 0) {
+                ec = std::error_code(errno, std::system_category());
+                return;
+            }
+            if (len == 0) {
+                break;
+            }
+            for (long pos = 0; pos < len;) {
+                auto entry = (linux_dirent64*)(buf_.get() + pos);
+                pos += entry->d_reclen;
+                if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+                    continue;
+                }
+                std::string_view name(entry->d_name);
+                auto pid = static_cast<uint32_t>(parse_uint(name));
+                scan_process(pid, entry->d_name, full);
+            }
+        }
+
+        index_.clear();
+        for (auto it = processes_.begin(); it != processes_.end();) {
+            if (it->second.generation != generation_) { //exited
+                it = processes_.erase(it);
+                continue;
+            }
+            for (auto inode : it->second.inodes) {
+                index_.emplace(inode, it->first);
+            }
+            ++it;
+        }
+    }
+
+    //incremental refresh, then a full one when a socket of entries has no owner yet.
+    //sockets a full refresh could not attribute, e.g. of hidden processes, do not trigger another.
+    void refresh(const std::vector<socket_entry>& entries, std::error_code& ec) {
+        refresh(false, ec);
+        if (ec) {
+            return;
+        }
+        auto unknown = [this](const socket_entry& entry) {
+            return entry.inode != 0 && index_.find(entry.inode) == index_.end();
+        };
+        bool full = false;
+        for (const auto& entry : entries) {
+            if (unknown(entry) && unresolved_.find(entry.inode) == unresolved_.end()) {
+                full = true;
+                break;
+            }
+        }
+        if (!full) {
+            return;
+        }
+        refresh(true, ec);
+        if (ec) {
+            return;
+        }
+        unresolved_.clear();
+        for (const auto& entry : entries) {
+            if (unknown(entry)) {
+                unresolved_.insert(entry.inode);
+            }
+        }
+    }
+
+    //pid holding the socket of inode, 0 when unknown
+    uint32_t owner(uint64_t inode) const {
+        auto it = index_.find(inode);
+        return it == index_.end() ? 0 : it->second;
+    }
+
+    //socket inodes held by pid, nullptr when pid was not scanned
+    const std::vector<uint64_t>* sockets(uint32_t pid) const {
+        auto it = processes_.find(pid);
+        return it == processes_.end() ? nullptr : &it->second.inodes;
+    }
+
+    size_t size() const {
+        return index_.size();
+    }
+
+private:
+    void scan_process(uint32_t pid, const char* pid_name, bool full) {
+        char path[32];
+        snprintf(path, sizeof(path), "%s/fd", pid_name);
+        auto& process = processes_[pid];
+        process.generation = generation_;
+        struct stat st;
+        if (fstatat(proc_fd_, path, &st, 0) == -1) { //exited or no permission
+            process.fd_count = -1;
+            process.inodes.clear();
+            return;
+        }
+        if (!full && st.st_size != 0 && st.st_size == process.fd_count) {
+            return;
+        }
+        process.fd_count = st.st_size;
+        process.inodes.clear();
+
+        auto fd_dir = openat(proc_fd_, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd_dir == -1) {
+            process.fd_count = -1;
+            return;
+        }
+        while (true) {
+            auto len = syscall(SYS_getdents64, fd_dir, fd_buf_.get(), buf_size);
+            if (len <= 0) {
+                break;
+            }
+            for (long pos = 0; pos < len;) {
+                auto entry = (linux_dirent64*)(fd_buf_.get() + pos);
+                pos += entry->d_reclen;
+                if (entry->d_name[0] == '.') {
+                    continue;
+                }
+                char link[64];
+                auto n = readlinkat(fd_dir, entry->d_name, link, sizeof(link) - 1);
+                if (n <= 8 || memcmp(link, "socket:[", 8) != 0) { //socket:[12345]
+                    continue;
+                }
+                std::string_view inode(link + 8, static_cast<size_t>(n - 8));
+                process.inodes.push_back(parse_uint(inode));
+            }
+        }
+        close(fd_dir);
+    }
+};
+
+//append an inet_diag bytecode op jumping to the next op on match and past the end otherwise.
+//no is patched by make_tcp_connection_bytecode once the total length is known.
+inline void append_bytecode_op(std::vector<uint8_t>& bytecode, uint8_t code, const void* arg, size_t arg_len) {
+    struct inet_diag_bc_op op{};
+    op.code = code;
+    op.yes = static_cast<uint8_t>(sizeof(op) + arg_len);
+    auto offset = bytecode.size();
+    bytecode.resize(offset + sizeof(op) + arg_len);
+    memcpy(bytecode.data() + offset, &op, sizeof(op));
+    memcpy(bytecode.data() + offset + sizeof(op), arg, arg_len);
+}
+
+inline void append_bytecode_port(std::vector<uint8_t>& bytecode, uint8_t ge, uint8_t le, uint16_t port) {
+    struct inet_diag_bc_op value{}; //the port is in no of the second op
+    value.no = port;
+    append_bytecode_op(bytecode, ge, &value, sizeof(value));
+    append_bytecode_op(bytecode, le, &value, sizeof(value));
+}
+
+//and of every condition in filter, empty when it matches any connection
+inline void make_tcp_connection_bytecode(const tcp_connection_filter& filter, std::vector<uint8_t>& bytecode) {
+    bytecode.clear();
+    if (filter.local_port != 0) {
+        append_bytecode_port(bytecode, INET_DIAG_BC_S_GE, INET_DIAG_BC_S_LE, filter.local_port);
+    }
+    if (filter.remote_family == AF_INET || filter.remote_family == AF_INET6) {
+        uint8_t cond[sizeof(struct inet_diag_hostcond) + 16]{};
+        auto host = (struct inet_diag_hostcond*)cond;
+        host->family = filter.remote_family;
+        host->prefix_len = filter.remote_prefix_length;
+        host->port = filter.remote_port != 0 ? filter.remote_port : -1;
+        size_t address_len = filter.remote_family == AF_INET ? 4 : 16;
+        memcpy(cond + sizeof(struct inet_diag_hostcond), filter.remote_address, address_len);
+        append_bytecode_op(bytecode, INET_DIAG_BC_D_COND, cond, sizeof(struct inet_diag_hostcond) + address_len);
+    }
+    else if (filter.remote_port != 0) {
+        append_bytecode_port(bytecode, INET_DIAG_BC_D_GE, INET_DIAG_BC_D_LE, filter.remote_port);
+    }
+    //a failed op jumps 4 bytes past the end, which rejects the socket
+    for (size_t offset = 0; offset < bytecode.size();) {
+        auto op = (struct inet_diag_bc_op*)(bytecode.data() + offset);
+        op->no = static_cast<uint16_t>(bytecode.size() - offset + 4);
+        offset += op->yes; //skips the value op of a port comparison, its no holds the port
+    }
+}
+
+//append tcp_info of the connections matching filter, one sock_diag dump per family
+inline void get_tcp_connection_info(std::vector<tcp_connection_info>& infos,
+    const tcp_connection_filter& filter, std::error_code& ec)
+{
+    ec.clear();
+    thread_local netlink_socket socket(NETLINK_SOCK_DIAG);
+    thread_local std::vector<uint8_t> bytecode;
+    make_tcp_connection_bytecode(filter, bytecode);
+
+    struct {
+        struct nlmsghdr hdr;
+        struct inet_diag_req_v2 req;
+        struct rtattr attr;
+        uint8_t bytecode[64];
+    } req{};
+    for (uint8_t family : { AF_INET, AF_INET6 }) {
+        req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct inet_diag_req_v2));
+        req.hdr.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        req.req.sdiag_family = family;
+        req.req.sdiag_protocol = IPPROTO_TCP;
+        req.req.idiag_states = filter.states;
+        req.req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+        if (!bytecode.empty()) {
+            req.attr.rta_type = INET_DIAG_REQ_BYTECODE;
+            req.attr.rta_len = static_cast<unsigned short>(RTA_LENGTH(bytecode.size()));
+            memcpy(req.bytecode, bytecode.data(), bytecode.size());
+            req.hdr.nlmsg_len += RTA_ALIGN(req.attr.rta_len);
+        }
+        socket.dump(&req.hdr, [&infos](const nlmsghdr* nlh) {
+            if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct inet_diag_msg))) {
+                return true;
+            }
+            auto msg = (const struct inet_diag_msg*)NLMSG_DATA(nlh);
+            struct tcp_info tcp{}; //shorter on older kernels, the missing tail stays 0
+            bool has_info = false;
+            for_each_rtattr((const rtattr*)(msg + 1), nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg)), [&](const rtattr* attr) {
+                if (attr->rta_type == INET_DIAG_INFO) {
+                    memcpy(&tcp, RTA_DATA(attr), std::min<size_t>(RTA_PAYLOAD(attr), sizeof(tcp)));
+                    has_info = true;
+                }
+            });
+            if (!has_info) { //time wait and new syn recv sockets have no tcp_info
+                return true;
+            }
+            auto& info = infos.emplace_back();
+            copy_socket_entry(msg, IPPROTO_TCP, info.socket);
+            info.rtt = tcp.tcpi_rtt;
+            info.rtt_var = tcp.tcpi_rttvar;
+            info.snd_cwnd = tcp.tcpi_snd_cwnd;
+            info.unacked = tcp.tcpi_unacked;
+            info.retrans = tcp.tcpi_retrans;
+            info.total_retrans = tcp.tcpi_total_retrans;
+            info.delivery_rate = tcp.tcpi_delivery_rate;
+            return true;
+        }, ec);
+        if (ec) {
+            return;
+        }
+    }
+}
+
+//aggregate tcp_info of the connections matching a filter into histograms per remote subnet.
+//peers are grouped by ipv4_prefix_length or ipv6_prefix_length bits of their address.
+//retransmits count the increase of tcpi_total_retrans since the previous collect, so a connection
+//which had trouble long ago does not look like one degrading now. a connection is matched by its
+//socket inode, one not seen by the previous collect only starts its baseline.
+class tcp_health_collector {
+private:
+    using subnet_key = std::array<uint8_t, 18>; //family, prefix length, masked address
+
+    uint8_t ipv4_prefix_length_;
+    uint8_t ipv6_prefix_length_;
+    std::vector<tcp_connection_info> connections_;
+    std::vector<tcp_subnet_health> subnets_;
+    std::map<subnet_key, size_t> index_;
+    std::unordered_map<uint64_t, uint32_t> total_retrans_; //by inode, of the previous collect
+    std::unordered_map<uint64_t, uint32_t> next_total_retrans_;
+
+public:
+    explicit tcp_health_collector(uint8_t ipv4_prefix_length = 24, uint8_t ipv6_prefix_length = 64)
+        : ipv4_prefix_length_(std::min<uint8_t>(ipv4_prefix_length, 32))
+        , ipv6_prefix_length_(std::min<uint8_t>(ipv6_prefix_length, 128)) {}
+
+    //replace the previous result with the connections matching filter now
+    void collect(const tcp_connection_filter& filter, std::error_code& ec) {
+        connections_.clear();
+        subnets_.clear();
+        index_.clear();
+        get_tcp_connection_info(connections_, filter, ec);
+        if (ec) {
+            return;
+        }
+        next_total_retrans_.clear();
+        for (const auto& connection : connections_) {
+            add(connection);
+        }
+        total_retrans_.swap(next_total_retrans_); //connections which closed are dropped
+    }
+
+    const std::vector<tcp_connection_info>& connections() const {
+        return connections_;
+    }
+
+    const std::vector<tcp_subnet_health>& subnets() const {
+        return subnets_;
+    }
+
+private:
+    void add(const tcp_connection_info& connection) {
+        static constexpr uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        const auto& socket = connection.socket;
+        subnet_key key{};
+        const uint8_t* address = socket.remote_address;
+        key[0] = socket.family;
+        if (socket.family == AF_INET6 && memcmp(address, v4_mapped, sizeof(v4_mapped)) == 0) {
+            key[0] = AF_INET;
+            address += sizeof(v4_mapped);
+        }
+        key[1] = key[0] == AF_INET ? ipv4_prefix_length_ : ipv6_prefix_length_;
+        for (size_t bit = 0; bit < key[1]; bit += 8) {
+            auto bits = std::min<size_t>(key[1] - bit, 8);
+            key[2 + bit / 8] = static_cast<uint8_t>(address[bit / 8] & (0xff00 >> bits));
+        }
+
+        auto [it, added] = index_.emplace(key, subnets_.size());
+        if (added) {
+            auto& subnet = subnets_.emplace_back();
+            subnet = tcp_subnet_health{};
+            subnet.family = key[0];
+            subnet.prefix_length = key[1];
+            memcpy(subnet.address, key.data() + 2, sizeof(subnet.address));
+        }
+        auto& subnet = subnets_[it->second];
+        subnet.connections++;
+        subnet.rtt.add(connection.rtt);
+        auto inode = connection.socket.inode;
+        if (inode != 0) {
+            next_total_retrans_[inode] = connection.total_retrans;
+            auto pre = total_retrans_.find(inode);
+            if (pre != total_retrans_.end()) {
+                auto increase = connection.total_retrans - std::min(pre->second, connection.total_retrans);
+                subnet.retrans += increase;
+                subnet.retrans_increase.add(increase);
+            }
+        }
+        subnet.unacked.add(connection.unacked);
+        subnet.delivery_rate.add(connection.delivery_rate);
+    }
+};
+
+//hand out free ports for tcp and udp services from one enumeration of the sockets of both.
+//ports in ip_local_port_range, where the kernel picks ephemeral ports for outgoing connections,
+//and in ip_local_reserved_ports are never handed out. a handed out port is not handed out again.
+//with reserve, each port is held by a tcp and a udp socket bound without SO_REUSEADDR, so a
+//launcher racing on the same host fails to bind it and moves to the next port. a bound socket is
+//not seen by sock_diag, the bind is what settles the race. hand the port over to a service by
+//passing the socket from take(), or by release() right before the service binds the port.
+class port_allocator {
+private:
+    struct holder {
+        int tcp = -1;
+        int udp = -1;
+    };
+
+    std::unique_ptr<port_bitmap> used_ = std::make_unique<port_bitmap>();
+    std::unique_ptr<port_bitmap> unavailable_ = std::make_unique<port_bitmap>();
+    std::unordered_map<uint16_t, holder> holders_;
+
+public:
+    port_allocator() {
+        used_->clear();
+        unavailable_->clear();
+    }
+
+    ~port_allocator() { release_all(); }
+
+    port_allocator(const port_allocator&) = delete;
+    port_allocator& operator=(const port_allocator&) = delete;
+
+    //enumerate tcp and udp sockets in every state and read the port sysctls
+    void refresh(std::error_code& ec) {
+        auto udp = std::make_unique<port_bitmap>();
+        get_port_bitmap(*used_, IPPROTO_TCP, tcp_all_states, ec);
+        if (ec) {
+            return;
+        }
+        get_port_bitmap(*udp, IPPROTO_UDP, tcp_all_states, ec);
+        if (ec) {
+            return;
+        }
+        for (size_t i = 0; i < std::size(used_->words); i++) {
+            used_->words[i] |= udp->words[i];
+        }
+        for (const auto& [port, h] : holders_) {
+            used_->set(port);
+        }
+
+        unavailable_->clear();
+        unavailable_->set(0);
+        std::error_code ig; //missing without ipv4 sysctls, e.g. in some sandboxes
+        char buf[4096];
+        proc_reader range_reader("/proc/sys/net/ipv4/ip_local_port_range");
+        auto range = range_reader.read(buf, ig);
+        if (!ig) {
+            auto first = parse_uint(range);
+            auto last = parse_uint(range);
+            set_range(first, last);
+        }
+        proc_reader reserved_reader("/proc/sys/net/ipv4/ip_local_reserved_ports");
+        auto reserved = reserved_reader.read(buf, ig);
+        while (!ig && !reserved.empty()) { //8080,9000-9010
+            auto first = parse_uint(reserved);
+            auto last = first;
+            if (!reserved.empty() && reserved[0] == '-') {
+                reserved.remove_prefix(1);
+                last = parse_uint(reserved);
+            }
+            set_range(first, last);
+            auto pos = reserved.find(',');
+            if (pos == std::string_view::npos) {
+                break;
+            }
+            reserved.remove_prefix(pos + 1);
+        }
+    }
+
+    bool is_free(uint16_t port) const {
+        return !used_->test(port) && !unavailable_->test(port);
+    }
+
+    //append up to count free ports of [first, last] in ascending order, return how many were added.
+    //with reserve a port another process took since refresh is skipped.
+    size_t allocate(size_t count, uint16_t first, uint16_t last, std::vector<uint16_t>& ports,
+        bool reserve, std::error_code& ec)
+    {
+        ec.clear();
+        size_t added = 0;
+        if (first > last) {
+            return added;
+        }
+        for (size_t i = first >> 6; i <= static_cast<size_t>(last >> 6) && added < count; i++) {
+            auto free = ~(used_->words[i] | unavailable_->words[i]);
+            if (i == static_cast<size_t>(first >> 6)) {
+                free &= ~0ull << (first & 63);
+            }
+            if (i == static_cast<size_t>(last >> 6) && (last & 63) != 63) {
+                free &= (1ull << ((last & 63) + 1)) - 1;
+            }
+            for (; free != 0 && added < count; free &= free - 1) {
+                auto port = static_cast<uint16_t>(i * 64 + static_cast<size_t>(__builtin_ctzll(free)));
+                used_->set(port);
+                if (reserve) {
+                    holder h;
+                    if (!hold(port, h, ec)) {
+                        if (ec) {
+                            return added;
+                        }
+                        continue; //taken by another process since refresh
+                    }
+                    holders_.emplace(port, h);
+                }
+                ports.push_back(port);
+                added++;
+            }
+        }
+        return added;
+    }
+
+    //give the holding tcp socket of a reserved port to the caller, e.g. to pass to a child service.
+    //the udp holder is closed. -1 when port is not reserved.
+    int take(uint16_t port) {
+        auto it = holders_.find(port);
+        if (it == holders_.end()) {
+            return -1;
+        }
+        auto fd = it->second.tcp;
+        if (it->second.udp != -1) {
+            close(it->second.udp);
+        }
+        holders_.erase(it);
+        return fd;
+    }
+
+    //close the holders of a reserved port, it stays handed out until the next refresh
+    void release(uint16_t port) {
+        auto it = holders_.find(port);
+        if (it == holders_.end()) {
+            return;
+        }
+        close_holder(it->second);
+        holders_.erase(it);
+    }
+
+    void release_all() {
+        for (auto& [port, h] : holders_) {
+            close_holder(h);
+        }
+        holders_.clear();
+    }
+
+private:
+    void set_range(uint64_t first, uint64_t last) {
+        for (auto port = first; port <= last && port < 65536; port++) {
+            unavailable_->set(static_cast<uint16_t>(port));
+        }
+    }
+
+    static void close_holder(holder& h) {
+        if (h.tcp != -1) {
+            close(h.tcp);
+        }
+        if (h.udp != -1) {
+            close(h.udp);
+        }
+        h = holder{};
+    }
+
+    //bind a socket of type on port for ipv4 and ipv6, -1 with EADDRINUSE when the port is taken
+    static int bind_port(int type, uint16_t port, std::error_code& ec) {
+        int family = AF_INET6;
+        auto fd = socket(family, type | SOCK_CLOEXEC, 0);
+        if (fd == -1 && errno == EAFNOSUPPORT) {
+            family = AF_INET;
+            fd = socket(family, type | SOCK_CLOEXEC, 0);
+        }
+        if (fd == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return -1;
+        }
+        sockaddr_storage address{}; //no SO_REUSEADDR, a second holder of the port must fail
+        socklen_t len = 0;
+        if (family == AF_INET6) {
+            int off = 0; //dual stack, holds the port for ipv4 too
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+            auto sin6 = (sockaddr_in6*)&address;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_addr = in6addr_any;
+            sin6->sin6_port = htons(port);
+            len = sizeof(sockaddr_in6);
+        }
+        else {
+            auto sin = (sockaddr_in*)&address;
+            sin->sin_family = AF_INET;
+            sin->sin_addr.s_addr = htonl(INADDR_ANY);
+            sin->sin_port = htons(port);
+            len = sizeof(sockaddr_in);
+        }
+        if (bind(fd, (sockaddr*)&address, len) == -1) {
+            if (errno != EADDRINUSE && errno != EACCES) {
+                ec = std::error_code(errno, std::system_category());
+            }
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static bool hold(uint16_t port, holder& h, std::error_code& ec) {
+        h.tcp = bind_port(SOCK_STREAM, port, ec);
+        if (h.tcp == -1) {
+            return false;
+        }
+        h.udp = bind_port(SOCK_DGRAM, port, ec);
+        if (h.udp == -1) {
+            close_holder(h);
+            return false;
+        }
+        return true;
+    }
+};
+
 inline auto get_environment_variable(std::string_view key, std::error_code& ec) {
     ec.clear();
 
@@ -0,0 +1,192 @@
+#pragma once
+#include <system_error>
+#include <memory>
+#include <cstdint>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "proc_reader.hpp"
+
+namespace asa {
+namespace posix {
+
+//netlink socket kept open between requests, so a dump costs one send and the receives of its reply.
+//the kernel assigns the port id, several sockets may live in one process. a socket opened before
+//fork is reopened in the child, parent and child would otherwise read each other's replies.
+class netlink_socket {
+private:
+    static constexpr size_t buf_size = 32 * 1024;
+    int protocol_;
+    uint32_t groups_;
+    int fd_ = -1;
+    uint32_t fork_generation_ = 0;
+    uint32_t seq_ = 0;
+    std::unique_ptr<char[]> buf_;
+
+public:
+    //groups is a mask of multicast groups to receive, e.g. RTMGRP_LINK
+    explicit netlink_socket(int protocol = NETLINK_ROUTE, uint32_t groups = 0)
+        : protocol_(protocol), groups_(groups) {}
+    ~netlink_socket() { close(); }
+
+    netlink_socket(const netlink_socket&) = delete;
+    netlink_socket& operator=(const netlink_socket&) = delete;
+
+    netlink_socket(netlink_socket&& s) noexcept
+        : protocol_(s.protocol_), groups_(s.groups_), fd_(s.fd_), fork_generation_(s.fork_generation_)
+        , seq_(s.seq_), buf_(std::move(s.buf_)) {
+        s.fd_ = -1;
+    }
+
+    netlink_socket& operator=(netlink_socket&& s) noexcept {
+        if (this != &s) {
+            close();
+            protocol_ = s.protocol_;
+            groups_ = s.groups_;
+            fd_ = s.fd_;
+            fork_generation_ = s.fork_generation_;
+            seq_ = s.seq_;
+            buf_ = std::move(s.buf_);
+            s.fd_ = -1;
+        }
+        return *this;
+    }
+
+    bool is_open() const { return fd_ != -1; }
+
+    int native_handle() const { return fd_; }
+
+    void open(std::error_code& ec) {
+        ec.clear();
+        auto generation = get_fork_generation();
+        if (fd_ != -1) {
+            if (fork_generation_ == generation) {
+                return;
+            }
+            ::close(fd_); //shared with the parent, do not read its replies
+            fd_ = -1;
+        }
+        fork_generation_ = generation;
+        fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol_);
+        if (fd_ == -1) {
+            ec = std::error_code(errno, std::system_category());
+            return;
+        }
+        struct sockaddr_nl local {};
+        local.nl_family = AF_NETLINK;
+        local.nl_groups = groups_;
+        if (bind(fd_, (struct sockaddr*)&local, sizeof(local)) < 0) {
+            ec = std::error_code(errno, std::system_category());
+            close();
+            return;
+        }
+        if (!buf_) {
+            buf_.reset(new char[buf_size]);
+        }
+    }
+
+    void close() {
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    //send req, a nlmsghdr followed by its payload, as a dump request and call f(const nlmsghdr*)
+    //for each reply message until NLMSG_DONE. f returns false to skip the rest of the reply.
+    template<typename F>
+    void dump(nlmsghdr* req, F&& f, std::error_code& ec) {
+        open(ec);
+        if (ec) {
+            return;
+        }
+        req->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        req->nlmsg_seq = ++seq_;
+        req->nlmsg_pid = 0;
+        struct sockaddr_nl kernel {};
+        kernel.nl_family = AF_NETLINK;
+        while (sendto(fd_, req, req->nlmsg_len, 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) {
+            if (errno != EINTR) {
+                ec = std::error_code(errno, std::system_category());
+                return;
+            }
+        }
+
+        bool stopped = false;
+        while (true) {
+            auto len = recv(fd_, buf_.get(), buf_size, 0);
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ec = std::error_code(errno, std::system_category());
+                close(); //the socket may hold the rest of the reply, start clean next time
+                return;
+            }
+            auto msg_len = static_cast<uint32_t>(len);
+            for (auto nlh = (struct nlmsghdr*)buf_.get(); NLMSG_OK(nlh, msg_len); nlh = NLMSG_NEXT(nlh, msg_len)) {
+                if (nlh->nlmsg_seq != seq_) { //notification or a stale reply
+                    continue;
+                }
+                if (nlh->nlmsg_type == NLMSG_DONE) {
+                    return;
+                }
+                if (nlh->nlmsg_type == NLMSG_ERROR) {
+                    auto err = (struct nlmsgerr*)NLMSG_DATA(nlh);
+                    if (err->error != 0) {
+                        ec = std::error_code(-err->error, std::system_category());
+                    }
+                    return;
+                }
+                if (!stopped && !f(static_cast<const nlmsghdr*>(nlh))) {
+                    stopped = true; //keep reading to drain the dump
+                }
+            }
+        }
+    }
+
+    //call f(const nlmsghdr*) for each pending multicast message without blocking.
+    //ENOBUFS in ec means messages were lost because the socket buffer overflowed.
+    template<typename F>
+    void receive(F&& f, std::error_code& ec) {
+        open(ec);
+        if (ec) {
+            return;
+        }
+        while (true) {
+            auto len = recv(fd_, buf_.get(), buf_size, MSG_DONTWAIT);
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ec = std::error_code(errno, std::system_category());
+                }
+                return;
+            }
+            auto msg_len = static_cast<uint32_t>(len);
+            for (auto nlh = (struct nlmsghdr*)buf_.get(); NLMSG_OK(nlh, msg_len); nlh = NLMSG_NEXT(nlh, msg_len)) {
+                if (nlh->nlmsg_type != NLMSG_DONE && nlh->nlmsg_type != NLMSG_ERROR) {
+                    f(static_cast<const nlmsghdr*>(nlh));
+                }
+            }
+        }
+    }
+};
+
+//call f(const rtattr*) for each attribute in [attr, attr + len)
+template<typename F>
+inline void for_each_rtattr(const rtattr* attr, uint32_t len, F&& f) {
+    auto ptr = const_cast<rtattr*>(attr);
+    for (; RTA_OK(ptr, len); ptr = RTA_NEXT(ptr, len)) {
+        f(static_cast<const rtattr*>(ptr));
+    }
+}
+
+}
+}
@@ -0,0 +1,344 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <list>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+namespace asa {
+namespace posix {
+
+//increased in the child after fork. a file opened before names the parent, e.g. /proc/self/stat.
+inline uint32_t get_fork_generation() {
+    static std::atomic<uint32_t> generation{ 0 };
+    static const bool registered = [] {
+        pthread_atfork(nullptr, nullptr, [] { generation.fetch_add(1, std::memory_order_relaxed); });
+        return true;
+    }();
+    (void)registered;
+    return generation.load(std::memory_order_relaxed);
+}
+
+//keep a procfs/sysfs file open and re-read it from offset 0 with pread,
+//so sampling the same file again costs no open/close and no allocation.
+//a reader opened before fork reopens its file in the child. it does not follow a later setns,
+//files such as /proc/net/dev keep showing the net namespace of the open.
+class proc_reader {
+private:
+    std::string path_;
+    int dir_fd_ = AT_FDCWD;
+    int fd_ = -1;
+    uint32_t fork_generation_ = 0;
+    bool retry_ = true;
+
+public:
+    proc_reader() = default;
+    explicit proc_reader(std::string path) : path_(std::move(path)) {}
+    //path is relative to dir_fd, which must stay open while the reader is used
+    proc_reader(int dir_fd, std::string path) : path_(std::move(path)), dir_fd_(dir_fd) {}
+    ~proc_reader() { close(); }
+
+    proc_reader(const proc_reader&) = delete;
+    proc_reader& operator=(const proc_reader&) = delete;
+
+    proc_reader(proc_reader&& r) noexcept
+        : path_(std::move(r.path_)), dir_fd_(r.dir_fd_), fd_(r.fd_)
+        , fork_generation_(r.fork_generation_), retry_(r.retry_) {
+        r.fd_ = -1;
+    }
+
+    proc_reader& operator=(proc_reader&& r) noexcept {
+        if (this != &r) {
+            close();
+            path_ = std::move(r.path_);
+            dir_fd_ = r.dir_fd_;
+            fd_ = r.fd_;
+            fork_generation_ = r.fork_generation_;
+            retry_ = r.retry_;
+            r.fd_ = -1;
+        }
+        return *this;
+    }
+
+    const std::string& path() const { return path_; }
+
+    bool is_open() const { return fd_ != -1; }
+
+    int native_handle() const { return fd_; }
+
+    //by default a read error closes the file and reopens it by path once. turn it off when the
+    //path may name another object after reopening, e.g. a reused tid, so the error is reported.
+    void set_retry(bool retry) { retry_ = retry; }
+
+    void open(std::error_code& ec) {
+        ec.clear();
+        auto generation = get_fork_generation();
+        if (fd_ != -1) {
+            if (fork_generation_ == generation) {
+                return;
+            }
+            close();
+        }
+        fork_generation_ = generation;
+        fd_ = ::openat(dir_fd_, path_.data(), O_RDONLY | O_CLOEXEC);
+        if (fd_ == -1) {
+            ec = std::error_code(errno, std::system_category());
+        }
+    }
+
+    void close() {
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    //read the file from offset 0 into buf, at most size - 1 bytes. the content is null terminated.
+    std::string_view read(char* buf, size_t size, std::error_code& ec) {
+        ec.clear();
+        if (size == 0) {
+            return {};
+        }
+        buf[0] = '\0';
+        bool reopened = !is_open() || !retry_;
+        open(ec);
+        if (ec) {
+            return {};
+        }
+
+        size_t len = 0;
+        while (len < size - 1) {
+            auto n = pread(fd_, buf + len, size - 1 - len, static_cast<off_t>(len));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ec = std::error_code(errno, std::system_category());
+                close();
+                if (reopened || len != 0) {
+                    buf[0] = '\0';
+                    return {};
+                }
+                //the object behind a long-lived fd may be gone (e.g. network card recreated), retry once
+                reopened = true;
+                open(ec);
+                if (ec) {
+                    return {};
+                }
+                continue;
+            }
+            if (n == 0) {
+                break;
+            }
+            len += static_cast<size_t>(n);
+        }
+        buf[len] = '\0';
+        return { buf, len };
+    }
+
+    template<size_t N>
+    std::string_view read(char(&buf)[N], std::error_code& ec) {
+        return read(buf, N, ec);
+    }
+
+    //read the file chunk by chunk through buf and call f for each line without '\n'.
+    //f returns false to stop early. lines longer than buf are truncated to the buf size.
+    template<typename F>
+    void for_each_line(char* buf, size_t size, F&& f, std::error_code& ec) {
+        ec.clear();
+        bool reopened = !is_open() || !retry_;
+        open(ec);
+        if (ec) {
+            return;
+        }
+
+        off_t offset = 0;
+        size_t carry = 0;
+        bool skip_rest = false;
+        while (true) {
+            auto n = pread(fd_, buf + carry, size - carry, offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ec = std::error_code(errno, std::system_category());
+                close();
+                if (reopened || offset != 0) {
+                    return;
+                }
+                reopened = true;
+                open(ec);
+                if (ec) {
+                    return;
+                }
+                continue;
+            }
+            if (n == 0) {
+                if (carry != 0 && !skip_rest) {
+                    f(std::string_view{ buf, carry });
+                }
+                return;
+            }
+            offset += n;
+
+            size_t len = carry + static_cast<size_t>(n);
+            size_t start = 0;
+            while (start < len) {
+                auto end = static_cast<char*>(memchr(buf + start, '\n', len - start));
+                if (end == nullptr) {
+                    break;
+                }
+                size_t pos = static_cast<size_t>(end - buf);
+                if (skip_rest) {
+                    skip_rest = false;
+                }
+                else if (!f(std::string_view{ buf + start, pos - start })) {
+                    return;
+                }
+                start = pos + 1;
+            }
+
+            carry = len - start;
+            if (carry == size) { //line is longer than buf
+                if (!skip_rest && !f(std::string_view{ buf, size })) {
+                    return;
+                }
+                skip_rest = true;
+                carry = 0;
+            }
+            else if (skip_rest) {
+                carry = 0;
+            }
+            else if (carry != 0 && start != 0) {
+                memmove(buf, buf + start, carry);
+            }
+        }
+    }
+
+    template<size_t N, typename F>
+    void for_each_line(char(&buf)[N], F&& f, std::error_code& ec) {
+        for_each_line(buf, N, std::forward<F>(f), ec);
+    }
+};
+
+//one reader per object for per-object sysfs attributes, e.g. /sys/class/net/<name>/operstate.
+//at most max_size files stay open, the least recently used is closed first, so thousands of
+//objects read by several threads do not use up the descriptor limit.
+class proc_reader_cache {
+private:
+    using entry = std::pair<std::string, proc_reader>;
+
+    size_t max_size_;
+    std::string prefix_;
+    std::string suffix_;
+    std::list<entry> readers_; //most recently used first
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index_;
+
+public:
+    proc_reader_cache(std::string prefix, std::string suffix, size_t max_size = 64)
+        : max_size_(std::max<size_t>(max_size, 1)), prefix_(std::move(prefix)), suffix_(std::move(suffix)) {}
+
+    proc_reader_cache(const proc_reader_cache&) = delete;
+    proc_reader_cache& operator=(const proc_reader_cache&) = delete;
+
+    proc_reader& get(const std::string& name) {
+        auto it = index_.find(name);
+        if (it != index_.end()) {
+            readers_.splice(readers_.begin(), readers_, it->second);
+            return it->second->second;
+        }
+        if (readers_.size() >= max_size_) {
+            index_.erase(readers_.back().first);
+            readers_.pop_back();
+        }
+        readers_.emplace_front(name, proc_reader(prefix_ + name + suffix_));
+        index_.emplace(readers_.front().first, readers_.begin());
+        return readers_.front().second;
+    }
+
+    void erase(const std::string& name) {
+        auto it = index_.find(name);
+        if (it != index_.end()) {
+            auto pos = it->second;
+            index_.erase(it);
+            readers_.erase(pos);
+        }
+    }
+};
+
+//split the next line off text, the line does not contain '\n'
+inline std::string_view next_line(std::string_view& text) {
+    auto pos = text.find('\n');
+    auto line = text.substr(0, pos);
+    text = (pos == std::string_view::npos) ? std::string_view{} : text.substr(pos + 1);
+    return line;
+}
+
+inline void skip_space(std::string_view& text) {
+    size_t i = 0;
+    while (i < text.size() && (text[i] == ' ' || text[i] == '\t')) {
+        i++;
+    }
+    text.remove_prefix(i);
+}
+
+//split the next whitespace separated token off text
+inline std::string_view next_token(std::string_view& text) {
+    skip_space(text);
+    size_t i = 0;
+    while (i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != '\n') {
+        i++;
+    }
+    auto token = text.substr(0, i);
+    text.remove_prefix(i);
+    return token;
+}
+
+//parse the next unsigned decimal number, leading whitespace is skipped
+inline uint64_t parse_uint(std::string_view& text) {
+    skip_space(text);
+    uint64_t value = 0;
+    size_t i = 0;
+    while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+        value = value * 10 + static_cast<uint64_t>(text[i] - '0');
+        i++;
+    }
+    text.remove_prefix(i);
+    return value;
+}
+
+//parse the next hex number without 0x prefix, leading whitespace is skipped
+inline uint64_t parse_hex(std::string_view& text) {
+    skip_space(text);
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < text.size(); i++) {
+        auto c = text[i];
+        if (c >= '0' && c <= '9') {
+            value = (value << 4) | static_cast<uint64_t>(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | static_cast<uint64_t>(c - 'a' + 10);
+        }
+        else if (c >= 'A' && c <= 'F') {
+            value = (value << 4) | static_cast<uint64_t>(c - 'A' + 10);
+        }
+        else {
+            break;
+        }
+    }
+    text.remove_prefix(i);
+    return value;
+}
+
+}
+}
@@ -2,11 +2,28 @@
 #include <unistd.h>
 #include <sys/sysinfo.h>
 #include <sys/prctl.h>
+#include <sys/statfs.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sched.h>
+#include <time.h>
+#include <math.h>
 
 #include <string>
 #include <system_error>
 #include <regex>
 #include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include "proc_reader.hpp"
+#include "host_handle.hpp"
 
 namespace asa {
 namespace posix {
@@ -44,102 +61,116 @@ inline std::string get_executable_name() {
     return name;
 }
 
+//cpu time of the process against wall time of all online cpus, all in ns
 struct self_cpu_occupy {
     uint64_t user_time;
     uint64_t sys_time;
     uint64_t total_time;
 };
 
+//cheapest sample of the process cpu time, one vdso call and one syscall
+struct self_cpu_time {
+    uint64_t cpu_ns;       //CLOCK_PROCESS_CPUTIME_ID
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC
+};
+
+inline uint64_t timespec_to_ns(const timespec& ts) {
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+inline uint64_t timeval_to_ns(const timeval& tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000000ull + static_cast<uint64_t>(tv.tv_usec) * 1000ull;
+}
+
+//online cpus, read once. get_nprocs parses sysfs on every call.
+inline uint64_t get_online_cpu_count() {
+    static const uint64_t count = static_cast<uint64_t>(std::max(get_nprocs(), 1));
+    return count;
+}
+
 inline self_cpu_occupy get_self_cpu_occupy(std::error_code& ec) {
     ec.clear();
-    FILE* fp = fopen("/proc/self/stat", "r"); //14 15
-    if (fp == nullptr) {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
         ec = std::error_code(errno, std::system_category());
         return {};
     }
-    self_cpu_occupy occupy{};
-    char buf[512] = { 0 };
-    fgets(buf, sizeof(buf), fp);
-    sscanf(buf, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu",
-        &occupy.user_time, &occupy.sys_time);
-    fclose(fp);
-
-    fp = fopen("/proc/stat", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return {};
-    }
-    uint64_t user = 0;
-    uint64_t nice = 0;
-    uint64_t system = 0;
-    uint64_t idle = 0;
-    char name[32]{};
-    while (fgets(buf, sizeof(buf), fp)) {
-        sscanf(buf, "%s %llu %llu %llu %llu",
-            name, &user, &nice, &system, &idle);
-
-        if (!strcmp("cpu", name)) {
-            break;
-        }
-        memset(buf, 0, sizeof(buf));
-        memset(name, 0, sizeof(name));
-    }
-    fclose(fp);
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    occupy.total_time = user + nice + system + idle;
+    self_cpu_occupy occupy{};
+    occupy.user_time = timeval_to_ns(usage.ru_utime);
+    occupy.sys_time = timeval_to_ns(usage.ru_stime);
+    occupy.total_time = timespec_to_ns(now) * get_online_cpu_count();
     return occupy;
 }
 
+//percentage of the whole host, 100 means every cpu is busy with this process
 inline double calculate_self_cpu_usage(const self_cpu_occupy& pre, const self_cpu_occupy& now)
 {
     auto pre_used = pre.user_time + pre.sys_time;
     auto now_used = now.user_time + now.sys_time;
-    auto used_detal = now_used - pre_used;
-    auto total_detal = now.total_time - pre.total_time;
-    if (total_detal == 0) {
+    if (now_used < pre_used || now.total_time <= pre.total_time) {
         return {};
     }
+    auto used_detal = now_used - pre_used;
+    auto total_detal = now.total_time - pre.total_time;
 
     auto self_cpu_usage = (double)used_detal * 100 / (double)total_detal;
     return self_cpu_usage;
 }
 
-inline auto get_self_memory_usage(std::error_code& ec) {
+inline self_cpu_time get_self_cpu_time(std::error_code& ec) {
     ec.clear();
-    FILE* fp = fopen("/proc/self/status", "r");
-    if (fp == nullptr) {
+    timespec cpu{};
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) != 0) {
         ec = std::error_code(errno, std::system_category());
-        return std::make_tuple(0.0, size_t(0), size_t(0));
+        return {};
+    }
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return { timespec_to_ns(cpu), timespec_to_ns(now) };
+}
+
+//same scale as calculate_self_cpu_usage of self_cpu_occupy
+inline double calculate_self_cpu_usage(const self_cpu_time& pre, const self_cpu_time& now)
+{
+    if (now.cpu_ns < pre.cpu_ns || now.timestamp_ns <= pre.timestamp_ns) {
+        return {};
     }
+    auto used_detal = now.cpu_ns - pre.cpu_ns;
+    auto total_detal = (now.timestamp_ns - pre.timestamp_ns) * get_online_cpu_count();
+    return (double)used_detal * 100 / (double)total_detal;
+}
 
+inline auto get_self_memory_usage(std::error_code& ec) {
+    ec.clear();
+    thread_local proc_reader status("/proc/self/status");
     uint64_t self_vm_rss = 0;
-    char name[256] = { 0 };
-    char buf[256] = { 0 };
-    while (fgets(buf, sizeof(buf), fp)) {   
-        sscanf(buf, "%s %llu", name, &self_vm_rss);
-        if (!strcmp("VmRSS:", name)) {
-            break;
+    char buf[256];
+    status.for_each_line(buf, [&self_vm_rss](std::string_view line) {
+        if (next_token(line) != "VmRSS:") {
+            return true;
         }
-        memset(name, 0, sizeof(name));
-        memset(buf, 0, sizeof(buf));
+        self_vm_rss = parse_uint(line);
+        return false;
+    }, ec);
+    if (ec) {
+        return std::make_tuple(0.0, size_t(0), size_t(0));
     }
-    fclose(fp);
 
+    thread_local proc_reader meminfo("/proc/meminfo");
     uint64_t mem_total = 0;
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == nullptr) {
-        ec = std::error_code(errno, std::system_category());
-        return std::make_tuple(0.0, size_t(0), size_t(0));
-    }
-    while (fgets(buf, sizeof(buf), fp)) {      
-        sscanf(buf, "%s %llu", name, &mem_total);
-        if (!strcmp("MemTotal:", name)) {
-            break;
+    meminfo.for_each_line(buf, [&mem_total](std::string_view line) {
+        if (next_token(line) != "MemTotal:") {
+            return true;
         }
-        memset(name, 0, sizeof(name));
-        memset(buf, 0, sizeof(buf));
+        mem_total = parse_uint(line);
+        return false;
+    }, ec);
+    if (ec) {
+        return std::make_tuple(0.0, size_t(0), size_t(0));
     }
-    fclose(fp);
 
     if (mem_total == 0) {
         return std::make_tuple(0.0, size_t(0), size_t(0));;
@@ -148,38 +179,315 @@ inline auto get_self_memory_usage(std::error_code& ec) {
     return std::make_tuple(self_mem_usage, self_vm_rss, mem_total);
 }
 
-inline bool is_in_container() {
-    FILE* fp = fopen("/proc/self/cgroup", "r");
-    if (fp == nullptr) {
-        return false;
+//memory of the process from /proc/self/smaps_rollup, in bytes.
+//pss shares each page among the processes mapping it, uss is the memory only this process holds.
+struct self_memory_info {
+    uint64_t rss;
+    uint64_t pss;
+    uint64_t pss_dirty;
+    uint64_t pss_anon;
+    uint64_t pss_file;
+    uint64_t pss_shmem;
+    uint64_t shared_clean;
+    uint64_t shared_dirty;
+    uint64_t private_clean;
+    uint64_t private_dirty;
+    uint64_t uss;             //private_clean + private_dirty
+    uint64_t anonymous;
+    uint64_t anon_huge_pages; //anonymous memory backed by transparent huge pages
+    uint64_t swap;
+    uint64_t swap_pss;
+    uint64_t locked;
+};
+
+//page counts of /proc/self/statm converted to bytes, a single short read
+struct self_memory_statm {
+    uint64_t size;     //virtual
+    uint64_t resident;
+    uint64_t shared;   //resident file backed and shmem
+    uint64_t text;
+    uint64_t data;     //data + stack
+};
+
+inline self_memory_info get_self_memory_info(std::error_code& ec) {
+    ec.clear();
+    static constexpr std::pair<std::string_view, uint64_t self_memory_info::*> fields[] = {
+        { "Rss:", &self_memory_info::rss },
+        { "Pss:", &self_memory_info::pss },
+        { "Pss_Dirty:", &self_memory_info::pss_dirty },
+        { "Pss_Anon:", &self_memory_info::pss_anon },
+        { "Pss_File:", &self_memory_info::pss_file },
+        { "Pss_Shmem:", &self_memory_info::pss_shmem },
+        { "Shared_Clean:", &self_memory_info::shared_clean },
+        { "Shared_Dirty:", &self_memory_info::shared_dirty },
+        { "Private_Clean:", &self_memory_info::private_clean },
+        { "Private_Dirty:", &self_memory_info::private_dirty },
+        { "Anonymous:", &self_memory_info::anonymous },
+        { "AnonHugePages:", &self_memory_info::anon_huge_pages },
+        { "Swap:", &self_memory_info::swap },
+        { "SwapPss:", &self_memory_info::swap_pss },
+        { "Locked:", &self_memory_info::locked },
+    };
+
+    thread_local proc_reader reader("/proc/self/smaps_rollup");
+    self_memory_info info{};
+    char buf[2048];
+    reader.for_each_line(buf, [&info](std::string_view line) {
+        auto key = next_token(line);
+        for (const auto& [name, field] : fields) {
+            if (key == name) {
+                info.*field = parse_uint(line) * 1024; //kB
+                break;
+            }
+        }
+        return true;
+    }, ec);
+    if (ec) {
+        return {};
     }
-    auto regex_id = std::regex(R"(^.*/(?:.*-)?([0-9a-f]+)(?:\.|\s*$))");
-    char buf[1024] = { 0 };
+    info.uss = info.private_clean + info.private_dirty;
+    return info;
+}
 
-    while (fgets(buf, 1024, fp)) {
-        if ((strstr(buf, "docker") != nullptr) ||
-            (strstr(buf, "kubepods") != nullptr) ||
-            (strstr(buf, "lxc") != nullptr) ||
-            (strstr(buf, "rkt") != nullptr) ||
-            (strstr(buf, "sandbox") != nullptr)) {
-            return true;
+inline self_memory_statm get_self_memory_statm(std::error_code& ec) {
+    ec.clear();
+    thread_local proc_reader reader("/proc/self/statm");
+    static const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    char buf[128];
+    auto statm = reader.read(buf, ec); //size resident shared text lib data dt
+    if (ec) {
+        return {};
+    }
+    self_memory_statm memory{};
+    memory.size = parse_uint(statm) * page_size;
+    memory.resident = parse_uint(statm) * page_size;
+    memory.shared = parse_uint(statm) * page_size;
+    memory.text = parse_uint(statm) * page_size;
+    parse_uint(statm); //lib, always 0
+    memory.data = parse_uint(statm) * page_size;
+    return memory;
+}
+
+inline bool is_in_container() {
+    thread_local proc_reader reader("/proc/self/cgroup");
+    static const auto regex_id = std::regex(R"(^.*/(?:.*-)?([0-9a-f]+)(?:\.|\s*$))");
+    char buf[1024];
+    bool in_container = false;
+    std::error_code ec;
+    reader.for_each_line(buf, [&in_container](std::string_view line) {
+        if ((line.find("docker") != std::string_view::npos) ||
+            (line.find("kubepods") != std::string_view::npos) ||
+            (line.find("lxc") != std::string_view::npos) ||
+            (line.find("rkt") != std::string_view::npos) ||
+            (line.find("sandbox") != std::string_view::npos)) {
+            in_container = true;
         }
         // maybe useful for unknown container
-        if (std::regex_match(buf, regex_id)) {
-            return true;
+        else if (std::regex_match(line.begin(), line.end(), regex_id)) {
+            in_container = true;
         }
-        memset(buf, 0, sizeof(buf));
-    }
-    fclose(fp);
-    return false;
+        return !in_container;
+    }, ec);
+    return in_container;
 }
 
 inline int get_self_pid() {
     return getpid();
 }
 
+enum class cgroup_version {
+    none,
+    v1,
+    v2  //unified hierarchy
+};
+
+//v2 when /sys/fs/cgroup is a cgroup2 mount, v1 when the cpu or memory controller has its own mount
+inline cgroup_version get_cgroup_version() {
+    static const auto version = [] {
+        struct statfs fs {};
+        if (statfs("/sys/fs/cgroup", &fs) == 0 && fs.f_type == CGROUP2_SUPER_MAGIC) {
+            return cgroup_version::v2;
+        }
+        std::error_code ec;
+        for (auto path : { "/sys/fs/cgroup/cpu/", "/sys/fs/cgroup/memory/", "/cgroup/cpu/", "/cgroup/memory/" }) {
+            if (std::filesystem::exists(path, ec)) {
+                return cgroup_version::v1;
+            }
+        }
+        return cgroup_version::none;
+    }();
+    return version;
+}
+
+//mount point of a v1 controller, empty when it is not mounted
+inline std::string get_cgroup_v1_path(const std::string& controller) {
+    std::error_code ec;
+    for (auto root : { "/sys/fs/cgroup/", "/cgroup/" }) {
+        auto path = root + controller + "/";
+        if (std::filesystem::exists(path, ec)) {
+            return path;
+        }
+    }
+    return {};
+}
+
+//directory of the cgroup the process is in for controller, e.g. "cpu" or "memory".
+//a container without cgroup namespace sees a host path, then the mount root is its own cgroup.
+inline std::string get_self_cgroup_path(const std::string& controller, std::error_code& ec) {
+    ec.clear();
+    thread_local proc_reader reader("/proc/self/cgroup");
+    auto version = get_cgroup_version();
+    std::string_view path;
+    bool found = false;
+    char buf[1024];
+    //0::/user.slice  or  4:cpu,cpuacct:/docker/abc
+    reader.for_each_line(buf, [&](std::string_view line) {
+        auto first = line.find(':');
+        auto second = line.find(':', first + 1);
+        if (first == std::string_view::npos || second == std::string_view::npos) {
+            return true;
+        }
+        auto controllers = line.substr(first + 1, second - first - 1);
+        if (version == cgroup_version::v2) {
+            found = controllers.empty();
+        }
+        else {
+            while (!controllers.empty() && !found) {
+                auto pos = controllers.find(',');
+                found = controllers.substr(0, pos) == controller;
+                controllers = (pos == std::string_view::npos) ? std::string_view{} : controllers.substr(pos + 1);
+            }
+        }
+        if (found) {
+            path = line.substr(second + 1);
+        }
+        return !found;
+    }, ec);
+    if (ec) {
+        return {};
+    }
+    if (!found || version == cgroup_version::none) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return {};
+    }
+
+    std::string root = (version == cgroup_version::v2) ? "/sys/fs/cgroup/" : get_cgroup_v1_path(controller);
+    if (root.empty()) {
+        ec = std::make_error_code(std::errc::no_such_file_or_directory);
+        return {};
+    }
+    std::string dir = root;
+    dir.append(path.substr(path.find_first_not_of('/') == std::string_view::npos ? path.size() : path.find_first_not_of('/')));
+    std::error_code ig;
+    if (!std::filesystem::exists(dir, ig)) {
+        return root;
+    }
+    return dir;
+}
+
+inline void write_cgroup_file(const std::string& file, std::string_view value, std::error_code& ec) {
+    ec.clear();
+    auto fd = open(file.data(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        ec = std::error_code(errno, std::system_category());
+        return;
+    }
+    if (write(fd, value.data(), value.size()) < 0) {
+        ec = std::error_code(errno, std::system_category());
+    }
+    close(fd);
+}
+
+//cgroup.procs moves every thread of the process, v2 has no per-process tasks file
+inline void join_cgroup_v2(const std::string& self_path, std::error_code& ec) {
+    write_cgroup_file(self_path + "/cgroup.procs", std::to_string(get_self_pid()), ec);
+}
+
+//move the process into a leaf group named after the executable below its own cgroup and enable
+//controller for it. v2 allows controllers only for children of a group without processes, so the
+//process leaves its cgroup first. in a cgroup namespace that cgroup is the container root, which
+//must hold no other process, otherwise enabling fails with EBUSY.
+//the joined group is remembered, so a later call enables another controller for it instead of
+//nesting a new leaf, while a process moved elsewhere since then gets a leaf in its new cgroup.
+inline std::string prepare_cgroup_v2(const std::string& controller, std::error_code& ec) {
+    static std::mutex mutex;
+    static std::string joined;
+    auto current = get_self_cgroup_path(controller, ec);
+    if (ec) {
+        return {};
+    }
+    std::filesystem::path self_path(current);
+    if (!self_path.has_filename()) { //trailing '/' of the mount root
+        self_path = self_path.parent_path();
+    }
+    self_path = self_path.lexically_normal();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (self_path.string() != joined) {
+        self_path /= get_executable_name();
+        std::filesystem::create_directory(self_path, ec);
+        if (ec) {
+            return {};
+        }
+        join_cgroup_v2(self_path.string(), ec);
+        if (ec) {
+            return {};
+        }
+        joined = self_path.string();
+    }
+    write_cgroup_file((self_path.parent_path() / "cgroup.subtree_control").string(), "+" + controller, ec);
+    if (ec) {
+        return {};
+    }
+    return self_path.string();
+}
+
+inline void set_cgroup_v2_cpu_limit(std::error_code& ec, float percentage) {
+    auto self_path = prepare_cgroup_v2("cpu", ec);
+    if (ec) {
+        return;
+    }
+
+    //cpu.max is "$MAX $PERIOD", keep the period
+    uint64_t period_us = 100000;
+    {
+        proc_reader reader(self_path + "/cpu.max");
+        char buf[64];
+        auto line = reader.read(buf, ec);
+        if (ec) {
+            return;
+        }
+        next_token(line);
+        if (auto period = parse_uint(line); period != 0) {
+            period_us = period;
+        }
+    }
+    auto quota_us = static_cast<uint64_t>(
+        static_cast<double>(period_us * get_nprocs()) * percentage / 100);
+    write_cgroup_file(self_path + "/cpu.max",
+        std::to_string(quota_us) + " " + std::to_string(period_us), ec);
+}
+
+inline void set_cgroup_v2_memory_limit(std::error_code& ec, uint64_t limit_bytes) {
+    auto self_path = prepare_cgroup_v2("memory", ec);
+    if (ec) {
+        return;
+    }
+    write_cgroup_file(self_path + "/memory.max", std::to_string(limit_bytes), ec);
+    if (ec) {
+        return;
+    }
+    //v1 limits memory + swap to the same value, the nearest v2 setting is no swap.
+    //swap accounting may be disabled, then the file does not exist.
+    std::error_code ig;
+    write_cgroup_file(self_path + "/memory.swap.max", "0", ig);
+}
+
 inline void set_cgroup_cpu_limit(std::error_code& ec, float percentage) {
     ec.clear();
+    if (get_cgroup_version() == cgroup_version::v2) {
+        set_cgroup_v2_cpu_limit(ec, percentage);
+        return;
+    }
     auto set_cgroup_cpu = [&ec, percentage](const std::string& cpu_path) {
         auto self_cpu_path = cpu_path + get_executable_name();
         std::filesystem::create_directory(self_cpu_path, ec);
@@ -240,6 +548,10 @@ inline void set_cgroup_cpu_limit(std::error_code& ec, float percentage) {
 
 inline void set_cgroup_memory_limit(std::error_code& ec, uint64_t limit_bytes) {
     ec.clear();
+    if (get_cgroup_version() == cgroup_version::v2) {
+        set_cgroup_v2_memory_limit(ec, limit_bytes);
+        return;
+    }
     auto set_cgroup_memory = [&ec, limit_bytes](const std::string& memory_path) {
         auto self_memory_path = memory_path + get_executable_name();
         std::filesystem::create_directory(self_memory_path, ec);
@@ -291,10 +603,787 @@ inline void set_cgroup_memory_limit(std::error_code& ec, uint64_t limit_bytes) {
     }
 }
 
+//relative cpu share of the group, 1 - 10000 with 100 as default. v1 maps it to cpu.shares.
+inline void set_cgroup_cpu_weight(std::error_code& ec, uint32_t weight) {
+    ec.clear();
+    weight = std::clamp<uint32_t>(weight, 1, 10000);
+    if (get_cgroup_version() == cgroup_version::v2) {
+        auto self_path = prepare_cgroup_v2("cpu", ec);
+        if (ec) {
+            return;
+        }
+        write_cgroup_file(self_path + "/cpu.weight", std::to_string(weight), ec);
+        return;
+    }
+
+    auto cpu_path = get_cgroup_v1_path("cpu");
+    if (cpu_path.empty()) {
+        return;
+    }
+    auto self_cpu_path = cpu_path + get_executable_name();
+    std::filesystem::create_directory(self_cpu_path, ec);
+    auto shares = std::max<uint64_t>(2, (uint64_t)weight * 1024 / 100);
+    write_cgroup_file(self_cpu_path + "/cpu.shares", std::to_string(shares), ec);
+    if (!ec) {
+        write_cgroup_file(self_cpu_path + "/tasks", std::to_string(get_self_pid()), ec);
+    }
+}
+
+//throttle and reclaim above high_bytes instead of oom kill. v1 maps it to memory.soft_limit_in_bytes.
+inline void set_cgroup_memory_high(std::error_code& ec, uint64_t high_bytes) {
+    ec.clear();
+    if (get_cgroup_version() == cgroup_version::v2) {
+        auto self_path = prepare_cgroup_v2("memory", ec);
+        if (ec) {
+            return;
+        }
+        write_cgroup_file(self_path + "/memory.high", std::to_string(high_bytes), ec);
+        return;
+    }
+
+    auto memory_path = get_cgroup_v1_path("memory");
+    if (memory_path.empty()) {
+        return;
+    }
+    auto self_memory_path = memory_path + get_executable_name();
+    std::filesystem::create_directory(self_memory_path, ec);
+    write_cgroup_file(self_memory_path + "/memory.soft_limit_in_bytes", std::to_string(high_bytes), ec);
+    if (!ec) {
+        write_cgroup_file(self_memory_path + "/tasks", std::to_string(get_self_pid()), ec);
+    }
+}
+
+//reader of a file in the cgroup of the process, reopened when the process moves to another cgroup
+inline proc_reader& get_self_cgroup_reader(
+    proc_reader& reader, const std::string& controller, const char* file, std::error_code& ec)
+{
+    auto dir = get_self_cgroup_path(controller, ec);
+    if (ec) {
+        return reader;
+    }
+    dir.append("/").append(file);
+    if (reader.path() != dir) {
+        reader = proc_reader(std::move(dir));
+    }
+    return reader;
+}
+
+//cpu.stat of the cgroup, v1 reports throttled_time in ns and no usage
+struct cgroup_cpu_stat {
+    uint64_t usage_usec;
+    uint64_t user_usec;
+    uint64_t system_usec;
+    uint64_t nr_periods;
+    uint64_t nr_throttled;
+    uint64_t throttled_usec;
+};
+
+//memory.events of the cgroup. v1 has failcnt as max and oom_kill from memory.oom_control only.
+struct cgroup_memory_events {
+    uint64_t low;
+    uint64_t high;
+    uint64_t max;
+    uint64_t oom;
+    uint64_t oom_kill;
+};
+
+struct cgroup_cpu_throttle {
+    uint64_t periods;
+    uint64_t throttled_periods;
+    uint64_t throttled_usec;
+    double throttled_ratio; //throttled_periods / periods
+};
+
+inline cgroup_cpu_stat get_cgroup_cpu_stat(std::error_code& ec) {
+    thread_local proc_reader reader;
+    auto& stat_reader = get_self_cgroup_reader(reader, "cpu", "cpu.stat", ec);
+    if (ec) {
+        return {};
+    }
+    cgroup_cpu_stat stat{};
+    char buf[512];
+    stat_reader.for_each_line(buf, [&stat](std::string_view line) {
+        auto key = next_token(line);
+        auto value = parse_uint(line);
+        if (key == "usage_usec") {
+            stat.usage_usec = value;
+        }
+        else if (key == "user_usec") {
+            stat.user_usec = value;
+        }
+        else if (key == "system_usec") {
+            stat.system_usec = value;
+        }
+        else if (key == "nr_periods") {
+            stat.nr_periods = value;
+        }
+        else if (key == "nr_throttled") {
+            stat.nr_throttled = value;
+        }
+        else if (key == "throttled_usec") {
+            stat.throttled_usec = value;
+        }
+        else if (key == "throttled_time") { //v1, ns
+            stat.throttled_usec = value / 1000;
+        }
+        return true;
+    }, ec);
+    if (ec) {
+        return {};
+    }
+    return stat;
+}
+
+inline cgroup_memory_events get_cgroup_memory_events(std::error_code& ec) {
+    cgroup_memory_events events{};
+    char buf[512];
+    auto parse = [&events](std::string_view line) {
+        auto key = next_token(line);
+        auto value = parse_uint(line);
+        if (key == "low") {
+            events.low = value;
+        }
+        else if (key == "high") {
+            events.high = value;
+        }
+        else if (key == "max") {
+            events.max = value;
+        }
+        else if (key == "oom") {
+            events.oom = value;
+        }
+        else if (key == "oom_kill") {
+            events.oom_kill = value;
+        }
+        return true;
+    };
+
+    if (get_cgroup_version() == cgroup_version::v2) {
+        thread_local proc_reader reader;
+        get_self_cgroup_reader(reader, "memory", "memory.events", ec);
+        if (!ec) {
+            reader.for_each_line(buf, parse, ec);
+        }
+        return ec ? cgroup_memory_events{} : events;
+    }
+
+    thread_local proc_reader oom_reader;
+    get_self_cgroup_reader(oom_reader, "memory", "memory.oom_control", ec);
+    if (!ec) {
+        oom_reader.for_each_line(buf, parse, ec);
+    }
+    if (ec) {
+        return {};
+    }
+    thread_local proc_reader failcnt_reader;
+    get_self_cgroup_reader(failcnt_reader, "memory", "memory.failcnt", ec);
+    if (!ec) {
+        std::string_view failcnt = failcnt_reader.read(buf, ec);
+        events.max = parse_uint(failcnt);
+    }
+    return ec ? cgroup_memory_events{} : events;
+}
+
+inline uint64_t cgroup_counter_delta(uint64_t pre, uint64_t now) {
+    return now > pre ? now - pre : 0;
+}
+
+inline cgroup_cpu_throttle calculate_cgroup_cpu_throttle(const cgroup_cpu_stat& pre, const cgroup_cpu_stat& now) {
+    cgroup_cpu_throttle throttle{};
+    throttle.periods = cgroup_counter_delta(pre.nr_periods, now.nr_periods);
+    throttle.throttled_periods = cgroup_counter_delta(pre.nr_throttled, now.nr_throttled);
+    throttle.throttled_usec = cgroup_counter_delta(pre.throttled_usec, now.throttled_usec);
+    if (throttle.periods != 0) {
+        throttle.throttled_ratio = (double)throttle.throttled_periods / (double)throttle.periods;
+    }
+    return throttle;
+}
+
+inline cgroup_memory_events calculate_cgroup_memory_events(
+    const cgroup_memory_events& pre, const cgroup_memory_events& now)
+{
+    cgroup_memory_events events{};
+    events.low = cgroup_counter_delta(pre.low, now.low);
+    events.high = cgroup_counter_delta(pre.high, now.high);
+    events.max = cgroup_counter_delta(pre.max, now.max);
+    events.oom = cgroup_counter_delta(pre.oom, now.oom);
+    events.oom_kill = cgroup_counter_delta(pre.oom_kill, now.oom_kill);
+    return events;
+}
+
+//limits of the container the process runs in. total falls back to the host when there is no limit.
+struct container_memory {
+    uint64_t total;  //bytes, memory.max or MemTotal
+    uint64_t usage;  //bytes, memory.current without inactive page cache, like the kubelet working set
+};
+
+struct container_cpu_occupy {
+    uint64_t usage_usec;   //cpu time of all tasks in the cgroup
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC
+};
+
+inline uint64_t get_host_memory_total(std::error_code& ec) {
+    thread_local proc_reader reader("/proc/meminfo");
+    uint64_t total = 0;
+    char buf[256];
+    reader.for_each_line(buf, [&total](std::string_view line) {
+        if (next_token(line) != "MemTotal:") {
+            return true;
+        }
+        total = parse_uint(line) * 1024;
+        return false;
+    }, ec);
+    return total;
+}
+
+//read a single number of a cgroup file, "max" and the v1 unlimited value return UINT64_MAX
+inline uint64_t read_cgroup_value(proc_reader& reader, std::error_code& ec) {
+    char buf[64];
+    auto text = reader.read(buf, ec);
+    if (ec) {
+        return 0;
+    }
+    skip_space(text);
+    if (text.substr(0, 3) == "max") {
+        return UINT64_MAX;
+    }
+    return parse_uint(text);
+}
+
+//call f(dir) for the cgroup of the process and each ancestor up to the mount root. a limit set on
+//an ancestor applies too, e.g. on the container group above the group made by a limit setter.
+template<typename F>
+inline void for_each_self_cgroup(const std::string& controller, F&& f, std::error_code& ec) {
+    auto dir = get_self_cgroup_path(controller, ec);
+    if (ec) {
+        return;
+    }
+    auto root = (get_cgroup_version() == cgroup_version::v2) ? std::string("/sys/fs/cgroup") : get_cgroup_v1_path(controller);
+    while (!root.empty() && root.back() == '/') {
+        root.pop_back();
+    }
+    while (!dir.empty() && dir.back() == '/') {
+        dir.pop_back();
+    }
+    while (true) {
+        f(dir);
+        auto pos = dir.rfind('/');
+        if (dir.size() <= root.size() || pos == std::string::npos) {
+            return;
+        }
+        dir.resize(pos);
+    }
+}
+
+//value of a cgroup file, UINT64_MAX for "max" and when the file cannot be read,
+//e.g. limit files do not exist in the v2 root group
+inline uint64_t read_cgroup_limit(const std::string& file) {
+    std::error_code ec;
+    proc_reader reader(file);
+    auto value = read_cgroup_value(reader, ec);
+    return ec ? UINT64_MAX : value;
+}
+
+//cfs quota and period of one cgroup directory, false when it has no quota
+inline bool read_cgroup_cpu_quota(const std::string& dir, uint64_t& quota, uint64_t& period) {
+    std::error_code ec;
+    char buf[64];
+    if (get_cgroup_version() == cgroup_version::v2) {
+        proc_reader reader(dir + "/cpu.max");
+        auto text = reader.read(buf, ec); //"max 100000" or "200000 100000"
+        skip_space(text);
+        if (ec || text.substr(0, 3) == "max") {
+            return false;
+        }
+        quota = parse_uint(text);
+        period = parse_uint(text);
+        return period != 0;
+    }
+    proc_reader reader(dir + "/cpu.cfs_quota_us");
+    auto text = reader.read(buf, ec); //-1 when unlimited
+    skip_space(text);
+    if (ec || text.empty() || text[0] == '-') {
+        return false;
+    }
+    quota = parse_uint(text);
+    period = read_cgroup_limit(dir + "/cpu.cfs_period_us");
+    return period != 0 && period != UINT64_MAX;
+}
+
+//number of cpus the process may use: the affinity mask (cpuset) capped by the smallest cfs quota
+//of its cgroup and the ancestors, may be fractional.
+inline double get_container_cpu_count(std::error_code& ec) {
+    ec.clear();
+    double count = get_nprocs();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        count = CPU_COUNT(&set);
+    }
+    for_each_self_cgroup("cpu", [&count](const std::string& dir) {
+        uint64_t quota = 0;
+        uint64_t period = 0;
+        if (read_cgroup_cpu_quota(dir, quota, period)) {
+            count = std::min(count, (double)quota / (double)period);
+        }
+    }, ec);
+    return count;
+}
+
+//limit is the smallest memory.max or memory.high (v1 memory.limit_in_bytes) of the cgroup of the
+//process and its ancestors, usage is of the group setting it, so the ratio shows the nearest oom.
+inline container_memory get_container_memory(std::error_code& ec) {
+    bool v2 = get_cgroup_version() == cgroup_version::v2;
+    uint64_t limit = UINT64_MAX;
+    std::string limit_dir;
+    for_each_self_cgroup("memory", [&](const std::string& dir) {
+        if (limit_dir.empty()) {
+            limit_dir = dir; //the own group when no limit is set
+        }
+        auto value = read_cgroup_limit(dir + (v2 ? "/memory.max" : "/memory.limit_in_bytes"));
+        if (v2) {
+            value = std::min(value, read_cgroup_limit(dir + "/memory.high"));
+        }
+        if (value < limit) {
+            limit = value;
+            limit_dir = dir;
+        }
+    }, ec);
+    if (ec) {
+        return {};
+    }
+
+    thread_local proc_reader current_reader;
+    thread_local proc_reader stat_reader;
+    auto current = limit_dir + (v2 ? "/memory.current" : "/memory.usage_in_bytes");
+    if (current_reader.path() != current) {
+        current_reader = proc_reader(std::move(current));
+        stat_reader = proc_reader(limit_dir + "/memory.stat");
+    }
+    container_memory memory{};
+    memory.usage = read_cgroup_value(current_reader, ec);
+    if (ec) {
+        return {};
+    }
+
+    uint64_t inactive_file = 0;
+    std::string_view key = v2 ? "inactive_file" : "total_inactive_file";
+    char buf[512];
+    stat_reader.for_each_line(buf, [&](std::string_view line) {
+        if (next_token(line) != key) {
+            return true;
+        }
+        inactive_file = parse_uint(line);
+        return false;
+    }, ec);
+    if (ec) {
+        return {};
+    }
+    memory.usage = memory.usage > inactive_file ? memory.usage - inactive_file : 0;
+
+    //v1 reports an unlimited cgroup as a huge page aligned value
+    auto host_total = get_host_memory_total(ec);
+    if (ec) {
+        return {};
+    }
+    memory.total = (limit == 0 || limit >= host_total) ? host_total : limit;
+    return memory;
+}
+
+inline int32_t calculate_container_memory_usage(const container_memory& memory) {
+    if (memory.total == 0) {
+        return {};
+    }
+    return (int32_t)ceil((double)memory.usage * 100 / (double)memory.total);
+}
+
+inline container_cpu_occupy get_container_cpu_occupy(std::error_code& ec) {
+    container_cpu_occupy occupy{};
+    if (get_cgroup_version() == cgroup_version::v2) {
+        auto stat = get_cgroup_cpu_stat(ec);
+        occupy.usage_usec = stat.usage_usec;
+    }
+    else {
+        thread_local proc_reader reader;
+        get_self_cgroup_reader(reader, "cpuacct", "cpuacct.usage", ec); //ns
+        if (!ec) {
+            occupy.usage_usec = read_cgroup_value(reader, ec) / 1000;
+        }
+    }
+    if (ec) {
+        return {};
+    }
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    occupy.timestamp_ns = timespec_to_ns(now);
+    return occupy;
+}
+
+//usage of the effective cpus of the container, 100 means the whole quota is used
+inline int32_t calculate_container_cpu_usage(
+    const container_cpu_occupy& pre, const container_cpu_occupy& now, double cpu_count)
+{
+    if (now.timestamp_ns <= pre.timestamp_ns || now.usage_usec < pre.usage_usec || cpu_count <= 0) {
+        return {};
+    }
+    auto used_detal = (double)(now.usage_usec - pre.usage_usec) * 1000;
+    auto total_detal = (double)(now.timestamp_ns - pre.timestamp_ns) * cpu_count;
+    auto usage = (int32_t)ceil(used_detal * 100 / total_detal);
+    return std::clamp(usage, 0, 100);
+}
+
 inline void set_thread_name(const std::string& name) {
     prctl(PR_SET_NAME, name.data());
 }
 
+//cpu and scheduling counters of one thread of the process
+struct thread_occupy {
+    int tid;
+    char name[16];                 //set by set_thread_name
+    int last_cpu;                  //cpu the thread last ran on
+    uint64_t user_time;            //ns, tick resolution
+    uint64_t sys_time;             //ns, tick resolution
+    uint64_t run_time;             //ns on cpu from schedstat, user + sys when schedstat is missing
+    uint64_t wait_time;            //ns runnable but waiting on a run queue, 0 when schedstat is missing
+    uint64_t voluntary_switches;   //blocked, e.g. on a lock or io
+    uint64_t involuntary_switches; //preempted, e.g. time slice exhausted
+};
+
+struct self_thread_occupy {
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC
+    std::vector<thread_occupy> threads; //sorted by tid
+};
+
+struct thread_usage {
+    int tid;
+    char name[16];
+    int last_cpu;
+    double cpu_usage;              //percentage of one cpu
+    double user_usage;
+    double sys_usage;
+    uint64_t wait_time;            //ns in the interval
+    uint64_t voluntary_switches;   //in the interval
+    uint64_t involuntary_switches;
+};
+
+//parse /proc/<pid>/task/<tid>/stat into occupy, times are left in ticks
+inline bool parse_thread_stat(std::string_view stat, thread_occupy& occupy) {
+    //comm may contain spaces and ')', so it ends at the last ')'
+    auto open = stat.find('(');
+    auto close = stat.rfind(')');
+    if (open == std::string_view::npos || close == std::string_view::npos || close < open) {
+        return false;
+    }
+    auto name = stat.substr(open + 1, std::min<size_t>(close - open - 1, sizeof(occupy.name) - 1));
+    memcpy(occupy.name, name.data(), name.size());
+    occupy.name[name.size()] = '\0';
+
+    stat.remove_prefix(close + 1);
+    for (int i = 3; i < 14; i++) {
+        next_token(stat);
+    }
+    occupy.user_time = parse_uint(stat); //14
+    occupy.sys_time = parse_uint(stat);  //15
+    for (int i = 16; i < 39; i++) {
+        next_token(stat);
+    }
+    occupy.last_cpu = static_cast<int>(parse_uint(stat)); //39
+    return true;
+}
+
+//collect thread_occupy of every thread of the process from /proc/self/task.
+//only the task directory stays open. the files of a thread are opened relative to it and closed
+//within each collection, so a process with many threads does not hold 3 descriptors per thread.
+class thread_collector {
+private:
+    DIR* dir_ = nullptr;
+    uint32_t fork_generation_ = 0; //a forked child still holds the task dir of its parent
+    uint64_t tick_ns_ = 1000000000ull / static_cast<uint64_t>(std::max(sysconf(_SC_CLK_TCK), 1L));
+
+public:
+    thread_collector() = default;
+    ~thread_collector() {
+        if (dir_ != nullptr) {
+            closedir(dir_);
+        }
+    }
+
+    thread_collector(const thread_collector&) = delete;
+    thread_collector& operator=(const thread_collector&) = delete;
+
+    void collect(self_thread_occupy& occupy, std::error_code& ec) {
+        ec.clear();
+        occupy.threads.clear();
+        auto generation = get_fork_generation();
+        if (dir_ != nullptr && fork_generation_ != generation) {
+            closedir(dir_);
+            dir_ = nullptr;
+        }
+        if (dir_ == nullptr) {
+            fork_generation_ = generation;
+            dir_ = opendir("/proc/self/task");
+            if (dir_ == nullptr) {
+                ec = std::error_code(errno, std::system_category());
+                return;
+            }
+        }
+        else {
+            rewinddir(dir_);
+        }
+
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        occupy.timestamp_ns = timespec_to_ns(now);
+
+        while (auto entry = readdir(dir_)) {
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+                continue;
+            }
+            thread_occupy thread{};
+            thread.tid = atoi(entry->d_name);
+            if (read_thread(entry->d_name, thread)) { //the thread may exit while reading
+                occupy.threads.emplace_back(thread);
+            }
+        }
+        std::sort(occupy.threads.begin(), occupy.threads.end(),
+            [](const thread_occupy& l, const thread_occupy& r) { return l.tid < r.tid; });
+    }
+
+private:
+    bool read_thread(const char* tid, thread_occupy& occupy) {
+        std::error_code ec;
+        char buf[1024];
+        std::string path(tid);
+        auto task_fd = dirfd(dir_);
+        auto stat = proc_reader(task_fd, path + "/stat").read(buf, ec);
+        if (ec || !parse_thread_stat(stat, occupy)) {
+            return false;
+        }
+        occupy.user_time *= tick_ns_;
+        occupy.sys_time *= tick_ns_;
+
+        auto schedstat = proc_reader(task_fd, path + "/schedstat").read(buf, ec); //run_ns wait_ns timeslices
+        if (!ec) {
+            occupy.run_time = parse_uint(schedstat);
+            occupy.wait_time = parse_uint(schedstat);
+        }
+        else {
+            occupy.run_time = occupy.user_time + occupy.sys_time;
+        }
+
+        proc_reader(task_fd, path + "/status").for_each_line(buf, [&occupy](std::string_view line) {
+            auto key = next_token(line);
+            if (key == "voluntary_ctxt_switches:") {
+                occupy.voluntary_switches = parse_uint(line);
+            }
+            else if (key == "nonvoluntary_ctxt_switches:") {
+                occupy.involuntary_switches = parse_uint(line);
+                return false; //last interesting line
+            }
+            return true;
+        }, ec);
+        return !ec;
+    }
+};
+
+//usage of threads alive in both occupies. a reused tid with a new name is skipped.
+inline void calculate_thread_usage(
+    const self_thread_occupy& pre, const self_thread_occupy& now, std::vector<thread_usage>& usage)
+{
+    usage.clear();
+    if (now.timestamp_ns <= pre.timestamp_ns) {
+        return;
+    }
+    auto wall = (double)(now.timestamp_ns - pre.timestamp_ns);
+    auto delta = [](uint64_t pre, uint64_t now) { return now > pre ? now - pre : 0; };
+    auto p = pre.threads.begin();
+    for (const auto& n : now.threads) {
+        while (p != pre.threads.end() && p->tid < n.tid) {
+            ++p;
+        }
+        if (p == pre.threads.end()) {
+            break;
+        }
+        if (p->tid != n.tid || strcmp(p->name, n.name) != 0) {
+            continue;
+        }
+        thread_usage u{};
+        u.tid = n.tid;
+        memcpy(u.name, n.name, sizeof(u.name));
+        u.last_cpu = n.last_cpu;
+        u.cpu_usage = (double)delta(p->run_time, n.run_time) * 100 / wall;
+        u.user_usage = (double)delta(p->user_time, n.user_time) * 100 / wall;
+        u.sys_usage = (double)delta(p->sys_time, n.sys_time) * 100 / wall;
+        u.wait_time = delta(p->wait_time, n.wait_time);
+        u.voluntary_switches = delta(p->voluntary_switches, n.voluntary_switches);
+        u.involuntary_switches = delta(p->involuntary_switches, n.involuntary_switches);
+        usage.emplace_back(u);
+    }
+}
+
+inline std::vector<thread_usage> calculate_thread_usage(const self_thread_occupy& pre, const self_thread_occupy& now) {
+    std::vector<thread_usage> usage;
+    calculate_thread_usage(pre, now, usage);
+    return usage;
+}
+
+inline int get_self_tid() {
+    return static_cast<int>(syscall(SYS_gettid));
+}
+
+//run queue delay of a registered thread in one sample interval
+struct thread_run_delay {
+    int tid;
+    char name[16];
+    uint64_t interval_ns;
+    uint64_t run_time;   //ns on cpu
+    uint64_t wait_time;  //ns runnable but not running
+    uint64_t timeslices; //times the thread got a cpu
+    double wait_ratio;   //wait_time / interval_ns
+    uint64_t avg_delay;  //ns waited per timeslice
+};
+
+//log2 histogram of per interval wait times in ns
+using run_delay_histogram = log2_histogram;
+
+//sample /proc/self/task/<tid>/schedstat of registered threads. the second field is the time a
+//thread was runnable but waited for a cpu, high values prove cpu contention rather than slow code.
+class run_delay_monitor {
+private:
+    struct schedstat_sample {
+        uint64_t timestamp_ns;
+        uint64_t run_time;
+        uint64_t wait_time;
+        uint64_t timeslices;
+    };
+
+    struct monitored_thread {
+        char name[16];
+        proc_reader schedstat;
+        schedstat_sample last{};
+        run_delay_histogram histogram{};
+    };
+
+    std::unordered_map<int, monitored_thread> threads_;
+    mutable std::mutex mutex_;
+
+public:
+    //register the calling thread, call after set_thread_name to keep its name
+    void add_thread(std::error_code& ec) {
+        add_thread(get_self_tid(), ec);
+    }
+
+    void add_thread(int tid, std::error_code& ec) {
+        ec.clear();
+        auto path = "/proc/self/task/" + std::to_string(tid);
+        monitored_thread thread;
+        thread.schedstat = proc_reader(path + "/schedstat");
+        thread.schedstat.set_retry(false); //once the thread exits, its tid may name another thread
+        thread.name[0] = '\0';
+        proc_reader comm(path + "/comm");
+        char buf[64];
+        auto name = comm.read(buf, ec);
+        if (ec) {
+            return;
+        }
+        name = name.substr(0, std::min(name.find('\n'), sizeof(thread.name) - 1));
+        memcpy(thread.name, name.data(), name.size());
+        thread.name[name.size()] = '\0';
+        if (!read(thread, ec)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.insert_or_assign(tid, std::move(thread));
+    }
+
+    void remove_thread() {
+        remove_thread(get_self_tid());
+    }
+
+    void remove_thread(int tid) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.erase(tid);
+    }
+
+    //delay of each registered thread since the previous sample, added to its histogram.
+    //threads which have exited are removed. an interval where a counter went backwards is skipped.
+    void sample(std::vector<thread_run_delay>& delays, std::error_code& ec) {
+        ec.clear();
+        delays.clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = threads_.begin(); it != threads_.end();) {
+            auto& thread = it->second;
+            auto pre = thread.last;
+            std::error_code read_ec;
+            if (!read(thread, read_ec)) {
+                if (read_ec == std::errc::no_such_file_or_directory || read_ec == std::errc::no_such_process) {
+                    it = threads_.erase(it);
+                    continue;
+                }
+                ec = read_ec;
+                ++it;
+                continue;
+            }
+
+            thread_run_delay delay{};
+            delay.tid = it->first;
+            memcpy(delay.name, thread.name, sizeof(delay.name));
+            auto& now = thread.last;
+            if (now.run_time < pre.run_time || now.wait_time < pre.wait_time || now.timeslices < pre.timeslices) {
+                ++it;
+                continue;
+            }
+            delay.interval_ns = now.timestamp_ns - pre.timestamp_ns;
+            delay.run_time = now.run_time - pre.run_time;
+            delay.wait_time = now.wait_time - pre.wait_time;
+            delay.timeslices = now.timeslices - pre.timeslices;
+            if (delay.interval_ns != 0) {
+                delay.wait_ratio = (double)delay.wait_time / (double)delay.interval_ns;
+            }
+            if (delay.timeslices != 0) {
+                delay.avg_delay = delay.wait_time / delay.timeslices;
+            }
+            thread.histogram.add(delay.wait_time);
+            delays.emplace_back(delay);
+            ++it;
+        }
+    }
+
+    bool histogram(int tid, run_delay_histogram& histogram) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = threads_.find(tid);
+        if (it == threads_.end()) {
+            return false;
+        }
+        histogram = it->second.histogram;
+        return true;
+    }
+
+    void reset_histogram() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [tid, thread] : threads_) {
+            thread.histogram = {};
+        }
+    }
+
+private:
+    static bool read(monitored_thread& thread, std::error_code& ec) {
+        char buf[128];
+        auto schedstat = thread.schedstat.read(buf, ec); //run_ns wait_ns timeslices
+        if (ec) {
+            return false;
+        }
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        thread.last.timestamp_ns = timespec_to_ns(now);
+        thread.last.run_time = parse_uint(schedstat);
+        thread.last.wait_time = parse_uint(schedstat);
+        thread.last.timeslices = parse_uint(schedstat);
+        return true;
+    }
+};
+
 using identifier = int;
 inline identifier lock_file(std::error_code&, const std::string&) {
     //empty
@@ -19,6 +19,21 @@ class program {
 public:
     using self_cpu_occupy = api::self_cpu_occupy;
     using identifier = api::identifier;
+#if !_WIN32 && !_AIX
+    using self_cpu_time = api::self_cpu_time;
+    using self_memory_info = api::self_memory_info;
+    using self_memory_statm = api::self_memory_statm;
+    using cgroup_cpu_stat = api::cgroup_cpu_stat;
+    using cgroup_memory_events = api::cgroup_memory_events;
+    using cgroup_cpu_throttle = api::cgroup_cpu_throttle;
+    using thread_occupy = api::thread_occupy;
+    using self_thread_occupy = api::self_thread_occupy;
+    using thread_usage = api::thread_usage;
+    using thread_collector = api::thread_collector;
+    using thread_run_delay = api::thread_run_delay;
+    using run_delay_histogram = api::run_delay_histogram;
+    using run_delay_monitor = api::run_delay_monitor;
+#endif
 public:
     auto get_executable_path() {
         return api::get_executable_path();
@@ -45,10 +60,32 @@ public:
         return api::calculate_self_cpu_usage(pre, now);
     }
 
+#if !_WIN32 && !_AIX
+    //cheaper than get_cpu_occupy, no user/system split
+    auto get_cpu_time(std::error_code& ec) {
+        return api::get_self_cpu_time(ec);
+    }
+
+    auto calculate_cpu_usage(const self_cpu_time& pre, const self_cpu_time& now) {
+        return api::calculate_self_cpu_usage(pre, now);
+    }
+#endif
+
     auto memory_usage(std::error_code& ec) {
         return api::get_self_memory_usage(ec);
     }
 
+#if !_WIN32 && !_AIX
+    //pss/uss breakdown, walks every mapping in the kernel, prefer get_memory_statm on hot paths
+    auto get_memory_info(std::error_code& ec) {
+        return api::get_self_memory_info(ec);
+    }
+
+    auto get_memory_statm(std::error_code& ec) {
+        return api::get_self_memory_statm(ec);
+    }
+#endif
+
     auto is_in_container() {
         return api::is_in_container();
     }
@@ -70,6 +107,58 @@ public:
         api::set_thread_name(name);
     }
 
+#if !_WIN32 && !_AIX
+    int get_tid() {
+        return api::get_self_tid();
+    }
+
+    //keep the collector to reuse the open files of each thread
+    void get_thread_occupy(thread_collector& collector, self_thread_occupy& occupy, std::error_code& ec) {
+        collector.collect(occupy, ec);
+    }
+
+    auto calculate_thread_usage(const self_thread_occupy& pre, const self_thread_occupy& now) {
+        return api::calculate_thread_usage(pre, now);
+    }
+
+    void calculate_thread_usage(
+        const self_thread_occupy& pre, const self_thread_occupy& now, std::vector<thread_usage>& usage)
+    {
+        api::calculate_thread_usage(pre, now, usage);
+    }
+#endif
+
+#if !_WIN32 && !_AIX //linux only
+    auto cgroup_version() {
+        return api::get_cgroup_version();
+    }
+
+    //1 - 10000, 100 is the default weight
+    void set_cgroup_cpu_weight(std::error_code& ec, uint32_t weight) {
+        api::set_cgroup_cpu_weight(ec, weight);
+    }
+
+    void set_cgroup_memory_high(std::error_code& ec, uint64_t high_bytes) {
+        api::set_cgroup_memory_high(ec, high_bytes);
+    }
+
+    auto get_cgroup_cpu_stat(std::error_code& ec) {
+        return api::get_cgroup_cpu_stat(ec);
+    }
+
+    auto calculate_cgroup_cpu_throttle(const cgroup_cpu_stat& pre, const cgroup_cpu_stat& now) {
+        return api::calculate_cgroup_cpu_throttle(pre, now);
+    }
+
+    auto get_cgroup_memory_events(std::error_code& ec) {
+        return api::get_cgroup_memory_events(ec);
+    }
+
+    auto calculate_cgroup_memory_events(const cgroup_memory_events& pre, const cgroup_memory_events& now) {
+        return api::calculate_cgroup_memory_events(pre, now);
+    }
+#endif
+
     identifier lock_file(std::error_code& ec, const std::string& file_path) {
         return api::lock_file(ec, file_path);
     }
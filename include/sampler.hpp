@@ -0,0 +1,275 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#if _WIN32 || _AIX
+#error "sampler is linux only"
+#endif
+
+#include "host.hpp"
+#include "program.hpp"
+
+namespace asa {
+
+//single writer, many readers. readers never block the writer and retry while a store is in progress.
+//the value is kept as atomic words, so a torn read is never observed as a data race.
+template<typename T>
+class seqlock {
+    static_assert(std::is_trivially_copyable_v<T>, "seqlock value must be trivially copyable");
+
+private:
+    static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    std::atomic<uint64_t> seq_{ 0 };
+    std::atomic<uint64_t> data_[words]{};
+
+public:
+    void store(const T& value) {
+        uint64_t buf[words]{};
+        memcpy(buf, &value, sizeof(T));
+        auto seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < words; i++) {
+            data_[i].store(buf[i], std::memory_order_relaxed);
+        }
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t buf[words];
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        do {
+            begin = seq_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < words; i++) {
+                buf[i] = data_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = seq_.load(std::memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    //number of completed stores
+    uint64_t version() const {
+        return seq_.load(std::memory_order_acquire) / 2;
+    }
+};
+
+//latest sample with the deltas against the previous one already computed
+struct host_sample {
+    uint64_t sequence;     //0 until the first sample is published
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC
+    uint64_t interval_ns;  //since the previous sample, 0 for the first one
+    uint32_t collected;    //collectors of the snapshot, cpu and network only when their deltas are computed too
+    api::cpu_occupy cpu;
+    double cpu_usage; //percentage of the interval
+    double cpu_user;
+    double cpu_system;
+    double cpu_iowait;
+    double cpu_steal;
+    api::memory_info memory;
+    double memory_usage; //(total - available) / total
+    uint64_t receive_bytes;  //physical cards only, traffic of lo, veth, bridge ... is already counted on them
+    uint64_t transmit_bytes;
+    double receive_bytes_per_second;
+    double transmit_bytes_per_second;
+    api::pressure_info cpu_pressure;
+    api::pressure_info memory_pressure;
+    api::pressure_info io_pressure;
+};
+
+//samples the host on its own named thread at a fixed, drift-free cadence and publishes the
+//latest host_sample through a seqlock, so any thread reads it without syscall or lock.
+class sampler {
+public:
+    using host_snapshot = host::host_snapshot;
+    //called on the sampler thread after each sample is published
+    using callback = std::function<void(const host_snapshot&, const host_sample&)>;
+
+private:
+    seqlock<host_sample> latest_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::atomic<bool> running_ = false;
+    callback callback_;
+
+public:
+    sampler() = default;
+    ~sampler() { stop(); }
+
+    sampler(const sampler&) = delete;
+    sampler& operator=(const sampler&) = delete;
+
+    //must be set before start
+    void set_callback(callback cb) {
+        callback_ = std::move(cb);
+    }
+
+    void start(std::chrono::nanoseconds interval, std::error_code& ec,
+        uint32_t mask = host::collector::collect_cpu | host::collector::collect_memory |
+        host::collector::collect_network | host::collector::collect_pressure,
+        const std::string& thread_name = "host_sampler")
+    {
+        ec.clear();
+        if (running_.load() || interval.count() <= 0) {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return;
+        }
+        stop_ = false;
+        try {
+            thread_ = std::thread([this, interval, mask, thread_name]() {
+                program{}.set_thread_name(thread_name);
+                run(interval, mask);
+            });
+            running_.store(true);
+        }
+        catch (const std::system_error& e) {
+            ec = e.code();
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        running_.store(false);
+    }
+
+    bool running() const { return running_.load(); }
+
+    host_sample latest() const { return latest_.load(); }
+
+    //number of published samples, cheap to poll for a new one
+    uint64_t version() const { return latest_.version(); }
+
+private:
+    void run(std::chrono::nanoseconds interval, uint32_t mask) {
+        host h;
+        host_snapshot snapshot[2]{};
+        size_t now = 0;
+        uint64_t sequence = 0;
+        auto next = std::chrono::steady_clock::now();
+        while (true) {
+            std::error_code ec;
+            h.snapshot(snapshot[now], mask, ec);
+            auto sample = make_sample(sequence == 0 ? nullptr : &snapshot[now ^ 1], snapshot[now]);
+            sample.sequence = ++sequence;
+            latest_.store(sample);
+            if (callback_) {
+                callback_(snapshot[now], sample);
+            }
+            now ^= 1;
+
+            //tick on start + k * interval, skip the ticks missed by a slow sample
+            next += interval;
+            auto current = std::chrono::steady_clock::now();
+            if (next <= current) {
+                next += ((current - next) / interval + 1) * interval;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (cv_.wait_until(lock, next, [this] { return stop_; })) {
+                return;
+            }
+        }
+    }
+
+    static uint64_t counter_detal(uint64_t pre, uint64_t now) {
+        return now > pre ? now - pre : 0;
+    }
+
+    static host_sample make_sample(const host_snapshot* pre, const host_snapshot& now) {
+        host_sample sample{};
+        sample.timestamp_ns = now.timestamp_ns;
+        sample.collected = now.collected;
+        sample.cpu = now.cpu;
+        sample.memory = now.memory;
+        if (now.collected & host::collector::collect_pressure) {
+            sample.cpu_pressure = now.cpu_pressure;
+            sample.memory_pressure = now.memory_pressure;
+            sample.io_pressure = now.io_pressure;
+        }
+
+        if (now.collected & host::collector::collect_memory && now.memory.total != 0) {
+            auto available = now.memory.available != 0 ? now.memory.available :
+                now.memory.free + now.memory.buffers + now.memory.cached;
+            sample.memory_usage = (double)(now.memory.total - std::min(available, now.memory.total)) *
+                100 / (double)now.memory.total;
+        }
+        if (now.collected & host::collector::collect_network) {
+            for (const auto& card : now.network) {
+                if (card.is_physics) {
+                    sample.receive_bytes += card.receive_bytes;
+                    sample.transmit_bytes += card.transmit_bytes;
+                }
+            }
+        }
+        if (pre == nullptr) {
+            return sample;
+        }
+
+        sample.interval_ns = counter_detal(pre->timestamp_ns, now.timestamp_ns);
+        //a delta needs the collector to have succeeded in both snapshots, a failed one holds zeros
+        auto both = pre->collected & now.collected;
+        constexpr uint32_t detal_mask = host::collector::collect_cpu | host::collector::collect_network;
+        sample.collected = (now.collected & ~detal_mask) | (both & detal_mask);
+        auto& p = pre->cpu;
+        auto& n = now.cpu;
+        auto total_detal = both & host::collector::collect_cpu ?
+            counter_detal(api::cpu_total_time(p), api::cpu_total_time(n)) : 0;
+        if (total_detal != 0) {
+            auto percent = [total_detal](uint64_t pre, uint64_t now) {
+                return (double)counter_detal(pre, now) * 100 / (double)total_detal;
+            };
+            sample.cpu_user = percent(p.user + p.nice, n.user + n.nice);
+            sample.cpu_system = percent(p.system + p.irq + p.softirq, n.system + n.irq + n.softirq);
+            sample.cpu_iowait = percent(p.iowait, n.iowait);
+            sample.cpu_steal = percent(p.steal, n.steal);
+            sample.cpu_usage = std::max(0.0, 100.0 - percent(p.idle, n.idle) - sample.cpu_iowait);
+        }
+        if (both & host::collector::collect_network && sample.interval_ns != 0) {
+            //rates per card, a card added or recreated since pre has no rate yet and one removed has none left
+            auto seconds = (double)sample.interval_ns / 1e9;
+            for (size_t i = 0; i < now.network.size(); i++) {
+                const auto& card = now.network[i];
+                if (!card.is_physics) {
+                    continue;
+                }
+                auto same = [&card](const api::card_counter& c) {
+                    return strcmp(c.name, card.name) == 0 && c.ifindex == card.ifindex;
+                };
+                auto it = i < pre->network.size() && same(pre->network[i]) ? pre->network.begin() + (ptrdiff_t)i :
+                    std::find_if(pre->network.begin(), pre->network.end(), same);
+                if (it == pre->network.end()) {
+                    continue;
+                }
+                api::card_rate rate;
+                api::calculate_card_rate(*it, card, seconds, rate);
+                if (!rate.reset) {
+                    sample.receive_bytes_per_second += rate.receive_bytes;
+                    sample.transmit_bytes_per_second += rate.transmit_bytes;
+                }
+            }
+        }
+        return sample;
+    }
+};
+
+}